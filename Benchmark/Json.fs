@@ -0,0 +1,70 @@
+﻿namespace MD.Benchmark
+
+open System
+open System.Globalization
+open System.IO
+
+/// A JSON value, as written in benchmark results.
+type Json =
+    | JsonNull
+    | JsonBool of bool
+    | JsonNumber of float
+    | JsonText of string
+    | JsonList of Json list
+    | JsonObject of (string * Json) list
+
+/// Contains functions for writing JSON values.
+[<CompilationRepresentation(CompilationRepresentationFlags.ModuleSuffix)>]
+module Json =
+
+    /// Writes a string as a quoted JSON string.
+    let private writeString (writer : TextWriter) (value : string) =
+        writer.Write '"'
+        for c in value do
+            match c with
+            | '"' -> writer.Write "\\\""
+            | '\\' -> writer.Write "\\\\"
+            | '\n' -> writer.Write "\\n"
+            | '\r' -> writer.Write "\\r"
+            | '\t' -> writer.Write "\\t"
+            | c when c < ' ' -> writer.Write (String.Format ("\\u{0:x4}", int c))
+            | c -> writer.Write c
+        writer.Write '"'
+
+    /// Writes a JSON value, indenting nested lists and objects by the given depth.
+    let rec private writeValue (writer : TextWriter) (depth : int) (value : Json) =
+        let indent depth = writer.Write (String (' ', depth * 2))
+        let writeItems (items : (unit -> unit) list) (opening : char) (closing : char) =
+            writer.Write opening
+            if not items.IsEmpty then
+                writer.WriteLine ()
+                items |> List.iteri (fun index write ->
+                    if index > 0 then writer.WriteLine ','
+                    indent (depth + 1)
+                    write ())
+                writer.WriteLine ()
+                indent depth
+            writer.Write closing
+        match value with
+        | JsonNull -> writer.Write "null"
+        | JsonBool value -> writer.Write (if value then "true" else "false")
+        | JsonNumber value when Double.IsNaN value || Double.IsInfinity value -> writer.Write "null"
+        | JsonNumber value -> writer.Write (value.ToString ("R", CultureInfo.InvariantCulture))
+        | JsonText null -> writer.Write "null"
+        | JsonText value -> writeString writer value
+        | JsonList items -> writeItems (items |> List.map (fun item () -> writeValue writer (depth + 1) item)) '[' ']'
+        | JsonObject fields ->
+            let writeField (name, value) () =
+                writeString writer name
+                writer.Write ": "
+                writeValue writer (depth + 1) value
+            writeItems (fields |> List.map writeField) '{' '}'
+
+    /// Writes a JSON value to the given writer.
+    let write (writer : TextWriter) (value : Json) = writeValue writer 0 value
+
+    /// Gets the JSON text for a value.
+    let format (value : Json) =
+        use writer = new StringWriter (CultureInfo.InvariantCulture)
+        write writer value
+        writer.ToString ()
@@ -0,0 +1,301 @@
+﻿module public MD.Benchmark.Program
+
+open System
+open System.Diagnostics
+open System.IO
+
+open MD
+open MD.Util
+open MD.DSP
+open MD.UI
+
+/// The resources used while running a benchmark.
+type Measurement = {
+
+    /// The wall time in seconds.
+    Time : float
+
+    /// The amount of bytes allocated in the app domain.
+    Allocated : int64
+
+    /// The amount of garbage collections for each generation.
+    Collections : int[]
+
+    }
+
+/// Runs the given action, measuring the resources it uses.
+let measure (action : unit -> 'a) =
+    let collections () = Array.init (GC.MaxGeneration + 1) GC.CollectionCount
+    GC.Collect ()
+    GC.WaitForPendingFinalizers ()
+    let startCollections = collections ()
+    let startAllocated = AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize
+    let watch = Stopwatch.StartNew ()
+    let result = action ()
+    watch.Stop ()
+    let allocated = AppDomain.CurrentDomain.MonitoringTotalAllocatedMemorySize - startAllocated
+    let endCollections = collections ()
+    result, {
+        Time = watch.Elapsed.TotalSeconds
+        Allocated = allocated
+        Collections = Array.map2 (-) endCollections startCollections
+    }
+
+/// Gets the median of the given values.
+let median (values : float[]) =
+    let sorted = Array.sort values
+    let count = sorted.Length
+    if count = 0 then nan
+    elif count % 2 = 1 then sorted.[count / 2]
+    else (sorted.[count / 2 - 1] + sorted.[count / 2]) / 2.0
+
+/// Gets a JSON description of a measurement, with allocations and collections given per second of decoded audio if
+/// the amount of audio is known.
+let describeMeasurement (measurement : Measurement) (audioSeconds : float) =
+    let perAudio (value : float) = if audioSeconds > 0.0 then JsonNumber (value / audioSeconds) else JsonNull
+    JsonObject [
+        "seconds", JsonNumber measurement.Time
+        "allocatedBytes", JsonNumber (float measurement.Allocated)
+        "allocatedBytesPerAudioSecond", perAudio (float measurement.Allocated)
+        "collections", JsonList (measurement.Collections |> Array.map (float >> JsonNumber) |> List.ofArray)
+        "collectionsPerAudioSecond", JsonList (measurement.Collections |> Array.map (float >> perAudio) |> List.ofArray)
+    ]
+
+/// The totals for a single content of a context while decoding.
+type DecodeTotals (content : Content) =
+    let mutable frames = 0L
+    let mutable bytes = 0L
+
+    /// Gets the content these totals are for.
+    member this.Content = content
+
+    /// Gets the amount of frames decoded.
+    member this.Frames = frames
+
+    /// Gets the amount of bytes of decoded output.
+    member this.Bytes = bytes
+
+    /// Gets the amount of seconds of decoded audio, or 0.0 for other content.
+    member this.Seconds =
+        match content with
+        | :? AudioContent as audio ->
+            let sampleSize = audio.OutputChannels * AudioContent.BytesPerSample audio.OutputFormat
+            float (bytes / int64 sampleSize) / audio.OutputSampleRate
+        | _ -> 0.0
+
+    /// Accounts for a decoded frame of the given size.
+    member this.Add (size : int64) =
+        frames <- frames + 1L
+        bytes <- bytes + size
+
+/// Reads the next frame of a context, returning the index of its content and the size of its decoded data, if any.
+let nextFrame (context : Context) =
+    let mutable index = 0
+    if context.NextFrame (&index) then
+        let size =
+            match context.Content.[index] with
+            | :? AudioContent as audio ->
+                match audio.Data with
+                | Some data ->
+                    let size = int64 data.Size
+                    match data with
+                    | :? AudioFrame as frame -> frame.Return ()
+                    | _ -> ()
+                    size
+                | None -> 0L
+            | :? VideoContent as video ->
+                match video.Data with
+                | Some frame -> Seq.init frame.PlaneCount (fun plane -> let plane = frame.Plane plane in int64 (plane.Stride * plane.Height)) |> Seq.sum
+                | None -> 0L
+            | _ -> 0L
+        Some (index, size)
+    else None
+
+/// Loads the given file and decodes all of its content once, returning the container name, the time to the first frame, the
+/// totals for each content and the statistics of the context.
+let decodeOnce (file : Path) =
+    let watch = Stopwatch.StartNew ()
+    let container, context = (Container.Load file).Value
+    let source = context.Object
+    let totals = source.Content |> Array.map (fun content -> new DecodeTotals (content))
+    let mutable first = nan
+    let mutable reading = true
+    while reading do
+        match nextFrame source with
+        | Some (index, size) ->
+            if Double.IsNaN first then first <- watch.Elapsed.TotalSeconds
+            totals.[index].Add size
+        | None -> reading <- false
+    let stats = source.Stats
+    context.Release.Invoke ()
+    container.Name, first, totals, stats
+
+/// Benchmarks decoding of the given file, returning a JSON description of the results.
+let benchmarkDecode (file : Path) (iterations : int) =
+    let fileSize = (new FileInfo (file.Source)).Length
+
+    // Warm up caches and plugin state, then measure each iteration.
+    decodeOnce file |> ignore
+    let runs = Array.init iterations (fun _ -> measure (fun () -> decodeOnce file))
+    let _, _, totals, _ = fst runs.[0]
+    let times = runs |> Array.map (fun (_, measurement) -> measurement.Time)
+    let firsts = runs |> Array.map (fun ((_, first, _, _), _) -> first)
+    let time = median times
+    let audioSeconds = totals |> Array.sumBy (fun total -> total.Seconds)
+    let container, _, _, _ = fst runs.[0]
+    let (_, _, _, stats), measurement = runs |> Array.minBy (fun (_, measurement) -> measurement.Time)
+    let describeContent (total : DecodeTotals) =
+        let content = total.Content
+        JsonObject [
+            "kind", JsonText (match content with
+                              | :? AudioContent -> "audio"
+                              | :? VideoContent -> "video"
+                              | _ -> "other")
+            "codec", JsonText (if content.Codec <> null then content.Codec.Name else null)
+            "frames", JsonNumber (float total.Frames)
+            "framesPerSecond", JsonNumber (float total.Frames / time)
+            "outputBytes", JsonNumber (float total.Bytes)
+            "outputMegabytesPerSecond", JsonNumber (float total.Bytes / time / 1.0e6)
+            "audioSeconds", JsonNumber total.Seconds
+        ]
+    JsonObject [
+        "file", JsonText file.Name
+        "container", JsonText container
+        "inputBytes", JsonNumber (float fileSize)
+        "iterations", JsonNumber (float iterations)
+        "medianSeconds", JsonNumber time
+        "inputMegabytesPerSecond", JsonNumber (float fileSize / time / 1.0e6)
+        "medianFirstFrameSeconds", JsonNumber (median firsts)
+        "audioSeconds", JsonNumber audioSeconds
+        "realtimeFactor", JsonNumber (audioSeconds / time)
+        "fastest", describeMeasurement measurement audioSeconds
+        "stats", JsonObject [
+            "bytesRead", JsonNumber (float stats.BytesRead)
+            "reads", JsonNumber (float stats.Reads)
+            "packetsDemuxed", JsonNumber (float stats.PacketsDemuxed)
+            "packetsDiscarded", JsonNumber (float stats.PacketsDiscarded)
+            "framesDecoded", JsonNumber (float stats.FramesDecoded)
+            "readSeconds", JsonNumber stats.ReadTime
+            "demuxSeconds", JsonNumber stats.DemuxTime
+            "decodeSeconds", JsonNumber stats.DecodeTime
+            "consumeSeconds", JsonNumber stats.ConsumeTime
+        ]
+        "content", JsonList (totals |> Array.map describeContent |> List.ofArray)
+    ]
+
+/// Benchmarks the DFT method given by DFT.get for real input of each of the given sizes, running each size for at least the
+/// given amount of seconds.
+let benchmarkDFT (sizes : int[]) (duration : float) =
+    let random = new Random (1)
+    let describeSize size =
+        let dft = DFT.get size
+        let input = Array.init size (fun _ -> random.NextDouble () * 2.0 - 1.0)
+        let output = Array.zeroCreate<Complex> size
+        let inputBuffer, unpinInput = Buffer.PinArray input
+        let outputBuffer, unpinOutput = Buffer.PinArray output
+        dft.ComputeReal (inputBuffer, outputBuffer)
+        let count, measurement =
+            measure (fun () ->
+                let watch = Stopwatch.StartNew ()
+                let mutable count = 0
+                while watch.Elapsed.TotalSeconds < duration do
+                    for i = 1 to 16 do
+                        dft.ComputeReal (inputBuffer, outputBuffer)
+                    count <- count + 16
+                count)
+        unpinInput ()
+        unpinOutput ()
+        let perTransform = measurement.Time / float count
+        JsonObject [
+            "size", JsonNumber (float size)
+            "method", JsonText (dft.GetType().Name)
+            "transforms", JsonNumber (float count)
+            "transformsPerSecond", JsonNumber (1.0 / perTransform)
+            "nanosecondsPerTransform", JsonNumber (perTransform * 1.0e9)
+            "megaflops", JsonNumber (2.5 * float size * Math.Log (float size, 2.0) / perTransform / 1.0e6)
+            "allocatedBytes", JsonNumber (float measurement.Allocated)
+        ]
+    JsonList (sizes |> Array.map describeSize |> List.ofArray)
+
+/// Benchmarks Spectrogram.CreateFigure for a synthetic signal of each of the given amounts of samples.
+let benchmarkSpectrogram (sampleCounts : int[]) =
+    let frame = SpectrogramFrame.ConstantQ (Window.hann, 22.0, 0.0005)
+    let coloring = Map.func (fun (_, value) -> let v = min 1.0 (value * 1.0e2) in Color.RGB (v, v, v))
+    let area = new Rectangle (-1.0, 1.0, -1.0, 0.0)
+    let describeCount sampleCount =
+        let samples = Array.init sampleCount (fun t -> sin (float t * 0.05) + 0.5 * sin (float t * 0.31))
+        let spectrogram = new Spectrogram (Data.array samples 0 sampleCount, frame)
+        spectrogram.CreateFigure (coloring, area) |> ignore
+        let _, measurement = measure (fun () -> spectrogram.CreateFigure (coloring, area))
+        JsonObject [
+            "samples", JsonNumber (float sampleCount)
+            "seconds", JsonNumber measurement.Time
+            "allocatedBytes", JsonNumber (float measurement.Allocated)
+            "collections", JsonList (measurement.Collections |> Array.map (float >> JsonNumber) |> List.ofArray)
+        ]
+    JsonList (sampleCounts |> Array.map describeCount |> List.ofArray)
+
+/// Reads the files of a corpus list, given one per line relative to the list. Empty lines and lines starting with '#' are
+/// ignored.
+let readCorpus (list : string) =
+    let directory = System.IO.Path.GetDirectoryName (System.IO.Path.GetFullPath list)
+    File.ReadAllLines list
+    |> Seq.map (fun line -> line.Trim ())
+    |> Seq.filter (fun line -> line.Length > 0 && not (line.StartsWith "#"))
+    |> Seq.map (fun line -> new Path (System.IO.Path.Combine (directory, line)))
+    |> List.ofSeq
+
+/// Runs all benchmarks and writes the results as JSON. Usage:
+///     Benchmark [-corpus <list>] [-output <file>] [-iterations <n>] [files...]
+/// Files given directly are benchmarked in addition to those in the corpus list, which defaults to corpus.txt in the working
+/// directory. Results are written to standard output unless an output file is given.
+[<EntryPoint>]
+let main args =
+    let wd = Path.WorkingDirectory
+    let pd = wd + "Plugins"
+    let plugins = Plugin.Enumerate pd |> List.ofSeq
+    for plugin in plugins do
+        plugin.Load () |> ignore
+    AppDomain.MonitoringIsEnabled <- true
+
+    let mutable corpus = "corpus.txt"
+    let mutable output = null
+    let mutable iterations = 3
+    let files = new System.Collections.Generic.List<Path> ()
+    let mutable index = 0
+    while index < args.Length do
+        match args.[index] with
+        | "-corpus" when index + 1 < args.Length ->
+            corpus <- args.[index + 1]
+            index <- index + 1
+        | "-output" when index + 1 < args.Length ->
+            output <- args.[index + 1]
+            index <- index + 1
+        | "-iterations" when index + 1 < args.Length ->
+            iterations <- max 1 (Int32.Parse args.[index + 1])
+            index <- index + 1
+        | file -> files.Add (new Path (file))
+        index <- index + 1
+    let files = (if File.Exists corpus then readCorpus corpus else []) @ List.ofSeq files
+
+    let decode =
+        files |> List.map (fun file ->
+            try benchmarkDecode file iterations
+            with ex -> JsonObject [ "file", JsonText file.Name; "error", JsonText ex.Message ])
+    let results =
+        JsonObject [
+            "date", JsonText (DateTime.UtcNow.ToString "o")
+            "machine", JsonText Environment.MachineName
+            "processors", JsonNumber (float Environment.ProcessorCount)
+            "is64Bit", JsonBool Environment.Is64BitProcess
+            "runtime", JsonText (Environment.Version.ToString ())
+            "plugins", JsonList (plugins |> List.map (fun plugin -> JsonText plugin.Name))
+            "decode", JsonList decode
+            "dft", benchmarkDFT [| 64; 256; 1024; 4096; 16384; 65536; 262144 |] 0.25
+            "spectrogram", benchmarkSpectrogram [| 1 <<< 16; 1 <<< 18; 1 <<< 20 |]
+        ]
+
+    let text = Json.format results
+    if output <> null then File.WriteAllText (output, text)
+    else Console.WriteLine text
+    0
@@ -0,0 +1,193 @@
+#include <math.h>
+#include <malloc.h>
+#include <string.h>
+#include <emmintrin.h>
+#if defined(_M_IX86)
+#include <intrin.h>
+#endif
+#include "fft.h"
+
+struct FFTPlan {
+	int Size;
+
+	// Twiddle factors e ^ (-2 pi i k / Size) for k < Size / 2, as interleaved complex values.
+	double* Twiddles;
+
+	// The bit-reversed index of each input.
+	int* Permutation;
+
+	// The plan of half the size, used for real input. This is NULL for the smallest plans.
+	FFTPlan* Half;
+};
+
+static bool _HasSSE2() {
+#if defined(_M_X64)
+	return true;
+#else
+	static int result = -1;
+	if (result < 0) {
+		int info[4];
+		__cpuid(info, 1);
+		result = (info[3] >> 26) & 1;
+	}
+	return result != 0;
+#endif
+}
+
+FFTPlan* FFTCreate(int Size) {
+	if (Size < 4 || (Size & (Size - 1)) != 0)
+		return NULL;
+
+	FFTPlan* plan = new FFTPlan();
+	plan->Size = Size;
+	plan->Twiddles = (double*)_aligned_malloc(Size * sizeof(double), 16);
+	plan->Permutation = new int[Size];
+	plan->Half = Size >= 8 ? FFTCreate(Size / 2) : NULL;
+
+	const double pi = 3.14159265358979323846;
+	for (int k = 0; k < Size / 2; k++) {
+		double angle = -2.0 * pi * k / Size;
+		plan->Twiddles[k * 2] = cos(angle);
+		plan->Twiddles[k * 2 + 1] = sin(angle);
+	}
+
+	int bits = 0;
+	while ((1 << bits) < Size)
+		bits++;
+	for (int i = 0; i < Size; i++) {
+		int r = 0;
+		for (int b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - b - 1);
+		plan->Permutation[i] = r;
+	}
+	return plan;
+}
+
+void FFTDestroy(FFTPlan* Plan) {
+	if (Plan == NULL)
+		return;
+	FFTDestroy(Plan->Half);
+	_aligned_free(Plan->Twiddles);
+	delete[] Plan->Permutation;
+	delete Plan;
+}
+
+// Multiplies two complex values held as (real, imaginary) pairs.
+static inline __m128d _Multiply(__m128d a, __m128d b) {
+	__m128d re = _mm_mul_pd(a, _mm_unpacklo_pd(b, b));
+	__m128d im = _mm_mul_pd(_mm_shuffle_pd(a, a, 1), _mm_unpackhi_pd(b, b));
+	return _mm_add_pd(re, _mm_xor_pd(im, _mm_set_pd(0.0, -0.0)));
+}
+
+// Applies the first two rounds of butterflies as radix-4 units, which need no twiddle factors.
+static void _Radix4(double* Data, int Size) {
+	for (int i = 0; i < Size; i += 4) {
+		double* x = Data + i * 2;
+		double ar = x[0] + x[2], ai = x[1] + x[3];
+		double br = x[0] - x[2], bi = x[1] - x[3];
+		double cr = x[4] + x[6], ci = x[5] + x[7];
+		double dr = x[4] - x[6], di = x[5] - x[7];
+		x[0] = ar + cr; x[1] = ai + ci;
+		x[4] = ar - cr; x[5] = ai - ci;
+		x[2] = br + di; x[3] = bi - dr;
+		x[6] = br - di; x[7] = bi + dr;
+	}
+}
+
+// Applies the remaining radix-2 rounds of butterflies, starting at units of 4.
+static void _Rounds(const FFTPlan* Plan, double* Data) {
+	int size = Plan->Size;
+	const double* twiddles = Plan->Twiddles;
+	bool sse = _HasSSE2();
+	for (int half = 4; half < size; half <<= 1) {
+		int step = size / (half * 2);
+		for (int unit = 0; unit < size; unit += half * 2) {
+			double* e = Data + unit * 2;
+			double* o = e + half * 2;
+			if (sse) {
+				for (int k = 0; k < half; k++) {
+					__m128d w = _mm_load_pd(twiddles + k * step * 2);
+					__m128d a = _mm_loadu_pd(e + k * 2);
+					__m128d b = _Multiply(_mm_loadu_pd(o + k * 2), w);
+					_mm_storeu_pd(e + k * 2, _mm_add_pd(a, b));
+					_mm_storeu_pd(o + k * 2, _mm_sub_pd(a, b));
+				}
+			} else {
+				for (int k = 0; k < half; k++) {
+					double wr = twiddles[k * step * 2], wi = twiddles[k * step * 2 + 1];
+					double orr = o[k * 2], oi = o[k * 2 + 1];
+					double br = orr * wr - oi * wi, bi = orr * wi + oi * wr;
+					double ar = e[k * 2], ai = e[k * 2 + 1];
+					e[k * 2] = ar + br; e[k * 2 + 1] = ai + bi;
+					o[k * 2] = ar - br; o[k * 2 + 1] = ai - bi;
+				}
+			}
+		}
+	}
+}
+
+void FFTComplex(const FFTPlan* Plan, const double* Input, double* Output) {
+	int size = Plan->Size;
+	const int* permutation = Plan->Permutation;
+	if (Input == Output) {
+		for (int i = 0; i < size; i++) {
+			int j = permutation[i];
+			if (j > i) {
+				double r = Output[i * 2], im = Output[i * 2 + 1];
+				Output[i * 2] = Output[j * 2]; Output[i * 2 + 1] = Output[j * 2 + 1];
+				Output[j * 2] = r; Output[j * 2 + 1] = im;
+			}
+		}
+	} else {
+		for (int i = 0; i < size; i++) {
+			int j = permutation[i];
+			Output[i * 2] = Input[j * 2];
+			Output[i * 2 + 1] = Input[j * 2 + 1];
+		}
+	}
+	_Radix4(Output, size);
+	_Rounds(Plan, Output);
+}
+
+void FFTReal(const FFTPlan* Plan, const double* Input, double* Output) {
+	int size = Plan->Size;
+	const FFTPlan* half = Plan->Half;
+	if (half == NULL) {
+		for (int i = 0; i < size; i++) {
+			Output[i * 2] = Input[i];
+			Output[i * 2 + 1] = 0.0;
+		}
+		FFTComplex(Plan, Output, Output);
+		return;
+	}
+
+	// Even samples are taken as the real parts and odd samples as the imaginary parts of a complex signal of half the
+	// size, whose transform is then split into the transforms of the even and odd samples.
+	int m = size / 2;
+	FFTComplex(half, Input, Output);
+	const double* twiddles = Plan->Twiddles;
+	for (int k = 0; k <= m / 2; k++) {
+		int j = (m - k) % m;
+		double zkr = Output[k * 2], zki = Output[k * 2 + 1];
+		double zjr = Output[j * 2], zji = Output[j * 2 + 1];
+
+		// Components k and k + m, from the even part E = (Z[k] + conj(Z[j])) / 2 and odd part O = (Z[k] - conj(Z[j])) / 2i.
+		double er = (zkr + zjr) * 0.5, ei = (zki - zji) * 0.5;
+		double or_ = (zki + zji) * 0.5, oi = (zjr - zkr) * 0.5;
+		double wr = twiddles[k * 2], wi = twiddles[k * 2 + 1];
+		double tr = or_ * wr - oi * wi, ti = or_ * wi + oi * wr;
+
+		// Components j and j + m, from the even part conj(E') and odd part conj(O') of the mirrored index.
+		double fr = er, fi = -ei;
+		double pr = or_, pi = -oi;
+		double vr = twiddles[j * 2], vi = twiddles[j * 2 + 1];
+		double sr = pr * vr - pi * vi, si = pr * vi + pi * vr;
+
+		Output[k * 2] = er + tr; Output[k * 2 + 1] = ei + ti;
+		Output[(k + m) * 2] = er - tr; Output[(k + m) * 2 + 1] = ei - ti;
+		if (j != k && j != 0) {
+			Output[j * 2] = fr + sr; Output[j * 2 + 1] = fi + si;
+			Output[(j + m) * 2] = fr - sr; Output[(j + m) * 2 + 1] = fi - si;
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+/// <summary>
+/// Precomputed twiddle factors and permutation for a native FFT of a certain size.
+/// </summary>
+struct FFTPlan;
+
+/// <summary>
+/// Creates a plan for a DFT of the given size, which must be a power of two of at least 4. Returns NULL if the plan
+/// can not be created.
+/// </summary>
+FFTPlan* FFTCreate(int Size);
+
+/// <summary>
+/// Computes the DFT of complex input, given as interleaved real and imaginary parts. The input and output may be the
+/// same, but may not otherwise overlap.
+/// </summary>
+void FFTComplex(const FFTPlan* Plan, const double* Input, double* Output);
+
+/// <summary>
+/// Computes the DFT of real input, writing all components of the spectrum as interleaved real and imaginary parts. The
+/// input and output may not overlap.
+/// </summary>
+void FFTReal(const FFTPlan* Plan, const double* Input, double* Output);
+
+/// <summary>
+/// Releases a plan created by FFTCreate.
+/// </summary>
+void FFTDestroy(FFTPlan* Plan);
@@ -0,0 +1,48 @@
+#include "plugin.h"
+
+_NativeDFT::_NativeDFT(int Size, FFTPlan* Plan) : DFT(Size) {
+	this->_Plan = Plan;
+	this->_Fallback = DFTModule::createManaged(Size);
+}
+
+_NativeDFT::~_NativeDFT() {
+	this->!_NativeDFT();
+}
+
+_NativeDFT::!_NativeDFT() {
+	if (this->_Plan != NULL) {
+		FFTDestroy(this->_Plan);
+		this->_Plan = NULL;
+	}
+}
+
+void _NativeDFT::ComputeReal(Buffer<Double> Input, Buffer<Complex> Output) {
+	if (Input.Stride != sizeof(double) || Output.Stride != sizeof(Complex)) {
+		this->_Fallback->ComputeReal(Input, Output);
+		return;
+	}
+	FFTReal(this->_Plan, (const double*)Input.Start.ToPointer(), (double*)Output.Start.ToPointer());
+	GC::KeepAlive(this);
+}
+
+void _NativeDFT::ComputeComplex(Buffer<Complex> Input, Buffer<Complex> Output) {
+	if (Input.Stride != sizeof(Complex) || Output.Stride != sizeof(Complex)) {
+		this->_Fallback->ComputeComplex(Input, Output);
+		return;
+	}
+	FFTComplex(this->_Plan, (const double*)Input.Start.ToPointer(), (double*)Output.Start.ToPointer());
+	GC::KeepAlive(this);
+}
+
+FSharpOption<DFT^>^ _NativeDFT::Create(int Size) {
+	if (Size < MinNativeSize)
+		return FSharpOption<DFT^>::None;
+	FFTPlan* plan = FFTCreate(Size);
+	if (plan == NULL)
+		return FSharpOption<DFT^>::None;
+	return FSharpOption<DFT^>::Some(gcnew _NativeDFT(Size, plan));
+}
+
+MD::Action^ ::Plugin::Load() {
+	return DFTModule::__identifier(register)(gcnew CreateDFTAction(_NativeDFT::Create));
+}
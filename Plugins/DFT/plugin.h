@@ -0,0 +1,51 @@
+#include "fft.h"
+
+using namespace System;
+using namespace MD;
+using namespace MD::DSP;
+using namespace Microsoft::FSharp::Core;
+
+/// <summary>
+/// The smallest DFT size computed natively. Smaller DFT's are left to the managed methods.
+/// </summary>
+const int MinNativeSize = 8;
+
+/// <summary>
+/// A DFT method computed by a native FFT. Buffers that are not contiguous are given to a managed method of the same size
+/// instead.
+/// </summary>
+ref class _NativeDFT : DFT {
+public:
+	_NativeDFT(int Size, FFTPlan* Plan);
+	~_NativeDFT();
+	!_NativeDFT();
+
+	virtual void ComputeReal(Buffer<Double> Input, Buffer<Complex> Output) override;
+	virtual void ComputeComplex(Buffer<Complex> Input, Buffer<Complex> Output) override;
+
+	/// <summary>
+	/// Tries creating a native DFT method for the given size.
+	/// </summary>
+	static FSharpOption<DFT^>^ Create(int Size);
+
+private:
+	FFTPlan* _Plan;
+	DFT^ _Fallback;
+};
+
+public ref class Plugin : MD::Plugin {
+public:
+	virtual property String^ Name {
+		String^ get() override {
+			return "Native DFT";
+		}
+	}
+
+	virtual property String^ Description {
+		String^ get() override {
+			return "Native, vectorized FFT used for all DFT's of power-of-two sizes.";
+		}
+	}
+
+	virtual MD::Action^ Load() override;
+};
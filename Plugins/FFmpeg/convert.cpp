@@ -0,0 +1,287 @@
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h>
+#if defined(_M_IX86)
+#include <intrin.h>
+#endif
+#include "convert.h"
+
+// Sample formats, matching AVSampleFormat.
+enum {
+	FormatU8 = 0,
+	FormatS16 = 1,
+	FormatS32 = 2,
+	FormatFloat = 3,
+	FormatDouble = 4
+};
+
+// The size, in bytes, of the scratch buffer used when converting and deinterleaving.
+const int ScratchSize = 32768;
+
+static int _SampleSize(int Format) {
+	switch (Format) {
+	case FormatU8: return 1;
+	case FormatS16: return 2;
+	case FormatS32: return 4;
+	case FormatFloat: return 4;
+	case FormatDouble: return 8;
+	default: return 0;
+	}
+}
+
+static bool _HasSSE2() {
+#if defined(_M_X64)
+	return true;
+#else
+	static int result = -1;
+	if (result < 0) {
+		int info[4];
+		__cpuid(info, 1);
+		result = (info[3] >> 26) & 1;
+	}
+	return result != 0;
+#endif
+}
+
+static double _ToDouble(const uint8_t* Source, int Format, int Index) {
+	switch (Format) {
+	case FormatU8: return (Source[Index] - 128) * (1.0 / 128.0);
+	case FormatS16: return ((const int16_t*)Source)[Index] * (1.0 / 32768.0);
+	case FormatS32: return ((const int32_t*)Source)[Index] * (1.0 / 2147483648.0);
+	case FormatFloat: return ((const float*)Source)[Index];
+	case FormatDouble: return ((const double*)Source)[Index];
+	default: return 0.0;
+	}
+}
+
+// Loads 4 integer samples of the given format, starting at the given index, as 32-bit integers.
+static __m128i _LoadInt4(const uint8_t* Source, int Format, int Index) {
+	switch (Format) {
+	case FormatU8: {
+		__m128i x = _mm_cvtsi32_si128(*(const int*)(Source + Index));
+		x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(x, _mm_setzero_si128()), _mm_setzero_si128());
+		return _mm_sub_epi32(x, _mm_set1_epi32(128));
+	}
+	case FormatS16: {
+		__m128i x = _mm_loadl_epi64((const __m128i*)(Source + Index * 2));
+		return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+	}
+	default:
+		return _mm_loadu_si128((const __m128i*)(Source + Index * 4));
+	}
+}
+
+static float _IntScale(int Format) {
+	switch (Format) {
+	case FormatU8: return 1.0f / 128.0f;
+	case FormatS16: return 1.0f / 32768.0f;
+	default: return 1.0f / 2147483648.0f;
+	}
+}
+
+static void _ConvertFloat(const uint8_t* Source, int Format, float* Target, int Count) {
+	int i = 0;
+	if (_HasSSE2()) {
+		if (Format == FormatDouble) {
+			const double* source = (const double*)Source;
+			for (; i + 4 <= Count; i += 4) {
+				__m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(source + i));
+				__m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(source + i + 2));
+				_mm_storeu_ps(Target + i, _mm_movelh_ps(lo, hi));
+			}
+		} else {
+			const __m128 scale = _mm_set1_ps(_IntScale(Format));
+			for (; i + 4 <= Count; i += 4)
+				_mm_storeu_ps(Target + i, _mm_mul_ps(_mm_cvtepi32_ps(_LoadInt4(Source, Format, i)), scale));
+		}
+	}
+	for (; i < Count; i++)
+		Target[i] = (float)_ToDouble(Source, Format, i);
+}
+
+static void _ConvertDouble(const uint8_t* Source, int Format, double* Target, int Count) {
+	int i = 0;
+	if (_HasSSE2()) {
+		if (Format == FormatFloat) {
+			const float* source = (const float*)Source;
+			for (; i + 4 <= Count; i += 4) {
+				__m128 x = _mm_loadu_ps(source + i);
+				_mm_storeu_pd(Target + i, _mm_cvtps_pd(x));
+				_mm_storeu_pd(Target + i + 2, _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+			}
+		} else {
+			const __m128d scale = _mm_set1_pd(_IntScale(Format));
+			for (; i + 4 <= Count; i += 4) {
+				__m128i x = _LoadInt4(Source, Format, i);
+				_mm_storeu_pd(Target + i, _mm_mul_pd(_mm_cvtepi32_pd(x), scale));
+				_mm_storeu_pd(Target + i + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(x, _MM_SHUFFLE(3, 2, 3, 2))), scale));
+			}
+		}
+	}
+	for (; i < Count; i++)
+		Target[i] = _ToDouble(Source, Format, i);
+}
+
+static void _Convert(const uint8_t* Source, int SourceFormat, uint8_t* Target, int TargetFormat, int Count) {
+	if (SourceFormat == TargetFormat)
+		memcpy(Target, Source, Count * _SampleSize(SourceFormat));
+	else if (TargetFormat == FormatFloat)
+		_ConvertFloat(Source, SourceFormat, (float*)Target, Count);
+	else if (TargetFormat == FormatDouble)
+		_ConvertDouble(Source, SourceFormat, (double*)Target, Count);
+}
+
+template <typename T>
+static void _Deinterleave(const T* Source, T* Target, int Channels, int Frames, int Stride) {
+	for (int c = 0; c < Channels; c++) {
+		T* target = Target + c * Stride;
+		const T* source = Source + c;
+		for (int j = 0; j < Frames; j++)
+			target[j] = source[j * Channels];
+	}
+}
+
+// Deinterleaves frames of samples of the given size, writing the samples for each channel at the given stride, in samples.
+static void _Deinterleave(const uint8_t* Source, uint8_t* Target, int Size, int Channels, int Frames, int Stride) {
+	int j = 0;
+	if (Channels == 2 && _HasSSE2()) {
+		if (Size == 4) {
+			const float* source = (const float*)Source;
+			float* left = (float*)Target;
+			float* right = left + Stride;
+			for (; j + 4 <= Frames; j += 4) {
+				__m128 a = _mm_loadu_ps(source + j * 2);
+				__m128 b = _mm_loadu_ps(source + j * 2 + 4);
+				_mm_storeu_ps(left + j, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+				_mm_storeu_ps(right + j, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+			}
+		} else if (Size == 8) {
+			const double* source = (const double*)Source;
+			double* left = (double*)Target;
+			double* right = left + Stride;
+			for (; j + 2 <= Frames; j += 2) {
+				__m128d a = _mm_loadu_pd(source + j * 2);
+				__m128d b = _mm_loadu_pd(source + j * 2 + 2);
+				_mm_storeu_pd(left + j, _mm_unpacklo_pd(a, b));
+				_mm_storeu_pd(right + j, _mm_unpackhi_pd(a, b));
+			}
+		}
+	}
+
+	// Remaining frames
+	Source += j * Channels * Size;
+	Target += j * Size;
+	Frames -= j;
+	switch (Size) {
+	case 1: _Deinterleave<uint8_t>(Source, Target, Channels, Frames, Stride); break;
+	case 2: _Deinterleave<uint16_t>((const uint16_t*)Source, (uint16_t*)Target, Channels, Frames, Stride); break;
+	case 4: _Deinterleave<uint32_t>((const uint32_t*)Source, (uint32_t*)Target, Channels, Frames, Stride); break;
+	case 8: _Deinterleave<uint64_t>((const uint64_t*)Source, (uint64_t*)Target, Channels, Frames, Stride); break;
+	}
+}
+
+void ConvertSamples(const uint8_t* Source, int SourceFormat, uint8_t* Target, int TargetFormat, int Channels, int Samples, bool Planar) {
+	if (!Planar || Channels == 1) {
+		_Convert(Source, SourceFormat, Target, TargetFormat, Channels * Samples);
+		return;
+	}
+
+	int size = _SampleSize(TargetFormat);
+	if (SourceFormat == TargetFormat) {
+		_Deinterleave(Source, Target, size, Channels, Samples, Samples);
+		return;
+	}
+
+	// Convert in chunks small enough to stay in cache, then deinterleave each chunk.
+	__declspec(align(16)) uint8_t scratch[ScratchSize];
+	int chunk = ScratchSize / (Channels * size);
+	int sourceframesize = Channels * _SampleSize(SourceFormat);
+	for (int offset = 0; offset < Samples; offset += chunk) {
+		int frames = Samples - offset < chunk ? Samples - offset : chunk;
+		_Convert(Source + offset * sourceframesize, SourceFormat, scratch, TargetFormat, frames * Channels);
+		_Deinterleave(scratch, Target + offset * size, size, Channels, frames, Samples);
+	}
+}
+
+struct SampleSummary {
+	int Channels;
+	int BlockSize;
+	int Fill;
+	float* Min;
+	float* Max;
+	double* Square;
+};
+
+static void _ResetSummary(SampleSummary* Summary) {
+	Summary->Fill = 0;
+	for (int c = 0; c < Summary->Channels; c++) {
+		Summary->Min[c] = 1.0e30f;
+		Summary->Max[c] = -1.0e30f;
+		Summary->Square[c] = 0.0;
+	}
+}
+
+static void _WriteSummary(SampleSummary* Summary, float* Blocks) {
+	for (int c = 0; c < Summary->Channels; c++) {
+		Blocks[c * 3] = Summary->Min[c];
+		Blocks[c * 3 + 1] = Summary->Max[c];
+		Blocks[c * 3 + 2] = (float)sqrt(Summary->Square[c] / Summary->Fill);
+	}
+	_ResetSummary(Summary);
+}
+
+SampleSummary* SummaryCreate(int Channels, int BlockSize) {
+	SampleSummary* summary = new SampleSummary();
+	summary->Channels = Channels;
+	summary->BlockSize = BlockSize;
+	summary->Min = new float[Channels];
+	summary->Max = new float[Channels];
+	summary->Square = new double[Channels];
+	_ResetSummary(summary);
+	return summary;
+}
+
+int SummaryAdd(SampleSummary* Summary, const uint8_t* Source, int Format, int Samples, float* Blocks) {
+	int channels = Summary->Channels;
+	int written = 0;
+	__declspec(align(16)) float scratch[ScratchSize / sizeof(float)];
+	int chunk = (int)(ScratchSize / sizeof(float)) / channels;
+	int sourceframesize = channels * _SampleSize(Format);
+
+	// Convert in chunks to float with the same conversion used for output, then fold each frame into the current block.
+	for (int offset = 0; offset < Samples; offset += chunk) {
+		int frames = Samples - offset < chunk ? Samples - offset : chunk;
+		_Convert(Source + offset * sourceframesize, Format, (uint8_t*)scratch, FormatFloat, frames * channels);
+		const float* frame = scratch;
+		for (int j = 0; j < frames; j++, frame += channels) {
+			for (int c = 0; c < channels; c++) {
+				float x = frame[c];
+				if (x < Summary->Min[c])
+					Summary->Min[c] = x;
+				if (x > Summary->Max[c])
+					Summary->Max[c] = x;
+				Summary->Square[c] += (double)x * x;
+			}
+			if (++Summary->Fill == Summary->BlockSize)
+				_WriteSummary(Summary, Blocks + (written++) * channels * 3);
+		}
+	}
+	return written;
+}
+
+int SummaryFlush(SampleSummary* Summary, float* Blocks) {
+	int fill = Summary->Fill;
+	if (fill == 0)
+		return 0;
+	_WriteSummary(Summary, Blocks);
+	return fill;
+}
+
+void SummaryDestroy(SampleSummary* Summary) {
+	if (Summary == NULL)
+		return;
+	delete[] Summary->Min;
+	delete[] Summary->Max;
+	delete[] Summary->Square;
+	delete Summary;
+}
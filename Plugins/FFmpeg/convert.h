@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+
+/// <summary>
+/// Converts interleaved samples from one sample format to another. Formats are given as AVSampleFormat values, and the
+/// target format must be the same as the source format, AV_SAMPLE_FMT_FLT or AV_SAMPLE_FMT_DBL. If planar is set, the
+/// target receives all samples for each channel contiguously. The source and target may not overlap.
+/// </summary>
+void ConvertSamples(const uint8_t* Source, int SourceFormat, uint8_t* Target, int TargetFormat, int Channels, int Samples, bool Planar);
+
+/// <summary>
+/// The running state of a summary of interleaved samples, giving the minimum, maximum and RMS of each channel over
+/// blocks of a fixed amount of samples.
+/// </summary>
+struct SampleSummary;
+
+/// <summary>
+/// Creates the state for summarizing samples with the given amount of channels over blocks of the given size.
+/// </summary>
+SampleSummary* SummaryCreate(int Channels, int BlockSize);
+
+/// <summary>
+/// Adds interleaved samples of the given format to a summary. Each block completed by the samples is written to the
+/// target as the minimum, maximum and RMS of each channel, so the target must have room for Samples / BlockSize + 1
+/// blocks. Returns the amount of blocks written.
+/// </summary>
+int SummaryAdd(SampleSummary* Summary, const uint8_t* Source, int Format, int Samples, float* Blocks);
+
+/// <summary>
+/// Writes the partial block of a summary, if any, to the target in the same form as SummaryAdd. Returns the amount of
+/// samples in the written block, or 0 if there was no partial block.
+/// </summary>
+int SummaryFlush(SampleSummary* Summary, float* Blocks);
+
+/// <summary>
+/// Releases the state of a summary.
+/// </summary>
+void SummaryDestroy(SampleSummary* Summary);
@@ -0,0 +1,25 @@
+#include <windows.h>
+#include "counters.h"
+
+int64_t CounterNow() {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+int64_t CounterFrequency() {
+	static int64_t frequency = 0;
+	if (frequency == 0) {
+		LARGE_INTEGER value;
+		QueryPerformanceFrequency(&value);
+		frequency = value.QuadPart;
+	}
+	return frequency;
+}
+
+void CountRead(ContextCounters* Counters, int64_t Start, int Size) {
+	Counters->Ticks[PhaseRead] += CounterNow() - Start;
+	Counters->Reads++;
+	if (Size > 0)
+		Counters->BytesRead += Size;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+
+/// <summary>
+/// The phases of work timed by context counters, matching ContextPhase.
+/// </summary>
+enum {
+	PhaseRead = 0,
+	PhaseDemux = 1,
+	PhaseDecode = 2,
+	PhaseConsume = 3,
+	PhaseCount = 4
+};
+
+/// <summary>
+/// Counters for the work done by a context. Times are given in ticks of CounterNow. Read counters are updated by the
+/// callbacks of the stream context of the context, including those that never enter managed code.
+/// </summary>
+struct ContextCounters {
+	int64_t BytesRead;
+	int64_t Reads;
+	int64_t PacketsDemuxed;
+	int64_t PacketsDiscarded;
+	int64_t FramesDecoded;
+	int64_t Ticks[PhaseCount];
+	int64_t Events[PhaseCount];
+};
+
+/// <summary>
+/// Gets the current value of the high-resolution performance counter. This is the same clock used by Stopwatch.
+/// </summary>
+int64_t CounterNow();
+
+/// <summary>
+/// Gets the amount of ticks of the performance counter in a second.
+/// </summary>
+int64_t CounterFrequency();
+
+/// <summary>
+/// Counts a read of the given size, in bytes, that started at the given time.
+/// </summary>
+void CountRead(ContextCounters* Counters, int64_t Start, int Size);
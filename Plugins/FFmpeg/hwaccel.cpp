@@ -0,0 +1,300 @@
+#define _WIN32_WINNT 0x0600
+#include <windows.h>
+#include <initguid.h>
+#include <d3d9.h>
+#include <dxva2api.h>
+#include <string.h>
+extern "C" {
+	#include "libavcodec/avcodec.h"
+	#include "libavcodec/dxva2.h"
+}
+#include "hwaccel.h"
+
+// The most surfaces a decoder may need: the reference frames of H.264, plus the frame being decoded and one held
+// by the reader.
+const int MaxSurfaces = 18;
+
+typedef IDirect3D9* (WINAPI *Direct3DCreate9Proc)(UINT);
+typedef HRESULT (WINAPI *DXVA2CreateVideoServiceProc)(IDirect3DDevice9*, REFIID, void**);
+
+struct HWAccel {
+	HMODULE D3D9Library;
+	HMODULE DXVA2Library;
+	IDirect3D9* D3D;
+	IDirect3DDevice9* Device;
+	IDirectXVideoDecoderService* Service;
+	IDirectXVideoDecoder* Decoder;
+	GUID Mode;
+	DXVA2_ConfigPictureDecode Config;
+	IDirect3DSurface9* Surfaces[MaxSurfaces];
+	bool SurfaceUsed[MaxSurfaces];
+	unsigned int SurfaceAge[MaxSurfaces];
+	int SurfaceCount;
+	unsigned int Age;
+	dxva_context Context;
+	bool Active;
+	uint8_t* Copy;
+	int CopySize;
+};
+
+// The decoder modes to try for each codec, in order of preference.
+static const GUID* const* _Modes(CodecID Codec) {
+	static const GUID* const h264[] = { &DXVA2_ModeH264_E, &DXVA2_ModeH264_F, NULL };
+	static const GUID* const mpeg2[] = { &DXVA2_ModeMPEG2_VLD, NULL };
+	static const GUID* const vc1[] = { &DXVA2_ModeVC1_D, NULL };
+	switch (Codec) {
+	case CODEC_ID_H264: return h264;
+	case CODEC_ID_MPEG2VIDEO: return mpeg2;
+	case CODEC_ID_VC1:
+	case CODEC_ID_WMV3: return vc1;
+	default: return NULL;
+	}
+}
+
+static void _ReleaseDecoder(HWAccel* Accel) {
+	if (Accel->Decoder != NULL) {
+		Accel->Decoder->Release();
+		Accel->Decoder = NULL;
+	}
+	for (int t = 0; t < Accel->SurfaceCount; t++)
+		Accel->Surfaces[t]->Release();
+	Accel->SurfaceCount = 0;
+}
+
+// Creates the surfaces and decoder for the current dimensions of the codec.
+static bool _CreateDecoder(HWAccel* Accel, AVCodecContext* Codec) {
+	_ReleaseDecoder(Accel);
+
+	// Surfaces must be aligned to whole macroblocks, and to 128 lines for MPEG-2.
+	int alignment = Codec->codec_id == CODEC_ID_MPEG2VIDEO ? 128 : 16;
+	UINT width = (Codec->coded_width + 15) & ~15;
+	UINT height = (Codec->coded_height + alignment - 1) & ~(alignment - 1);
+	int count = Codec->codec_id == CODEC_ID_H264 ? MaxSurfaces : 4;
+	if (FAILED(Accel->Service->CreateSurface(width, height, count - 1, (D3DFORMAT)MAKEFOURCC('N', 'V', '1', '2'),
+		D3DPOOL_DEFAULT, 0, DXVA2_VideoDecoderRenderTarget, Accel->Surfaces, NULL)))
+		return false;
+	Accel->SurfaceCount = count;
+	for (int t = 0; t < count; t++) {
+		Accel->SurfaceUsed[t] = false;
+		Accel->SurfaceAge[t] = 0;
+	}
+
+	// Pick a configuration, preferring the one for unmodified bitstreams.
+	DXVA2_VideoDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.SampleWidth = Codec->coded_width;
+	desc.SampleHeight = Codec->coded_height;
+	desc.Format = (D3DFORMAT)MAKEFOURCC('N', 'V', '1', '2');
+	UINT configcount = 0;
+	DXVA2_ConfigPictureDecode* configs = NULL;
+	if (FAILED(Accel->Service->GetDecoderConfigurations(Accel->Mode, &desc, NULL, &configcount, &configs)))
+		return false;
+	int best = -1;
+	int bestscore = 0;
+	for (UINT t = 0; t < configcount; t++) {
+		int score = configs[t].ConfigBitstreamRaw == 2 && Codec->codec_id == CODEC_ID_H264 ? 2 : configs[t].ConfigBitstreamRaw == 1 ? 1 : 0;
+		if (score > bestscore) {
+			best = t;
+			bestscore = score;
+		}
+	}
+	if (best >= 0)
+		Accel->Config = configs[best];
+	CoTaskMemFree(configs);
+	if (best < 0)
+		return false;
+
+	if (FAILED(Accel->Service->CreateVideoDecoder(Accel->Mode, &desc, &Accel->Config, Accel->Surfaces, count, &Accel->Decoder)))
+		return false;
+
+	memset(&Accel->Context, 0, sizeof(Accel->Context));
+	Accel->Context.decoder = Accel->Decoder;
+	Accel->Context.cfg = &Accel->Config;
+	Accel->Context.surface_count = count;
+	Accel->Context.surface = Accel->Surfaces;
+	if (IsEqualGUID(Accel->Mode, DXVA2_ModeMPEG2_VLD))
+		Accel->Context.workaround = FF_DXVA2_WORKAROUND_SCALING_LIST_ZIGZAG;
+	return true;
+}
+
+static enum PixelFormat _GetFormat(AVCodecContext* Codec, const enum PixelFormat* Formats) {
+	HWAccel* accel = (HWAccel*)Codec->opaque;
+	for (const enum PixelFormat* format = Formats; *format != PIX_FMT_NONE; format++) {
+		if (*format == PIX_FMT_DXVA2_VLD && _CreateDecoder(accel, Codec)) {
+			accel->Active = true;
+			Codec->hwaccel_context = &accel->Context;
+			return PIX_FMT_DXVA2_VLD;
+		}
+	}
+
+	// Fall back to software decoding.
+	_ReleaseDecoder(accel);
+	accel->Active = false;
+	Codec->hwaccel_context = NULL;
+	return avcodec_default_get_format(Codec, Formats);
+}
+
+static int _GetBuffer(AVCodecContext* Codec, AVFrame* Picture) {
+	HWAccel* accel = (HWAccel*)Codec->opaque;
+	if (!accel->Active)
+		return avcodec_default_get_buffer(Codec, Picture);
+
+	// Use the least recently used free surface.
+	int index = -1;
+	for (int t = 0; t < accel->SurfaceCount; t++) {
+		if (!accel->SurfaceUsed[t] && (index < 0 || accel->SurfaceAge[t] < accel->SurfaceAge[index]))
+			index = t;
+	}
+	if (index < 0)
+		return -1;
+	accel->SurfaceUsed[index] = true;
+	accel->SurfaceAge[index] = ++accel->Age;
+
+	memset(Picture->data, 0, sizeof(Picture->data));
+	memset(Picture->linesize, 0, sizeof(Picture->linesize));
+	Picture->data[0] = (uint8_t*)accel->Surfaces[index];
+	Picture->data[3] = (uint8_t*)accel->Surfaces[index];
+	Picture->type = FF_BUFFER_TYPE_USER;
+	Picture->age = 256 * 256 * 256 * 64;
+	return 0;
+}
+
+static void _ReleaseBuffer(AVCodecContext* Codec, AVFrame* Picture) {
+	HWAccel* accel = (HWAccel*)Codec->opaque;
+	if (Picture->type != FF_BUFFER_TYPE_USER) {
+		avcodec_default_release_buffer(Codec, Picture);
+		return;
+	}
+	IDirect3DSurface9* surface = (IDirect3DSurface9*)Picture->data[3];
+	for (int t = 0; t < accel->SurfaceCount; t++) {
+		if (accel->Surfaces[t] == surface)
+			accel->SurfaceUsed[t] = false;
+	}
+	memset(Picture->data, 0, sizeof(Picture->data));
+}
+
+HWAccel* HWAccelInit(AVCodecContext* Codec) {
+	const GUID* const* modes = _Modes(Codec->codec_id);
+	if (modes == NULL)
+		return NULL;
+
+	HWAccel* accel = new HWAccel();
+	memset(accel, 0, sizeof(HWAccel));
+
+	// Load Direct3D and DXVA2 dynamically so machines without them fall back to software decoding.
+	accel->D3D9Library = LoadLibraryW(L"d3d9.dll");
+	accel->DXVA2Library = LoadLibraryW(L"dxva2.dll");
+	if (accel->D3D9Library == NULL || accel->DXVA2Library == NULL) {
+		HWAccelClose(accel);
+		return NULL;
+	}
+	Direct3DCreate9Proc create = (Direct3DCreate9Proc)GetProcAddress(accel->D3D9Library, "Direct3DCreate9");
+	DXVA2CreateVideoServiceProc createservice = (DXVA2CreateVideoServiceProc)GetProcAddress(accel->DXVA2Library, "DXVA2CreateVideoService");
+	if (create == NULL || createservice == NULL || (accel->D3D = create(D3D_SDK_VERSION)) == NULL) {
+		HWAccelClose(accel);
+		return NULL;
+	}
+
+	D3DPRESENT_PARAMETERS parameters;
+	memset(&parameters, 0, sizeof(parameters));
+	parameters.Windowed = TRUE;
+	parameters.hDeviceWindow = GetDesktopWindow();
+	parameters.SwapEffect = D3DSWAPEFFECT_DISCARD;
+	parameters.BackBufferFormat = D3DFMT_UNKNOWN;
+	parameters.BackBufferWidth = 1;
+	parameters.BackBufferHeight = 1;
+	if (FAILED(accel->D3D->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, parameters.hDeviceWindow,
+		D3DCREATE_SOFTWARE_VERTEXPROCESSING | D3DCREATE_MULTITHREADED | D3DCREATE_FPU_PRESERVE, &parameters, &accel->Device)) ||
+		FAILED(createservice(accel->Device, __uuidof(IDirectXVideoDecoderService), (void**)&accel->Service))) {
+		HWAccelClose(accel);
+		return NULL;
+	}
+
+	// Find a decoder mode supported by the device that outputs NV12.
+	UINT guidcount = 0;
+	GUID* guids = NULL;
+	bool found = false;
+	if (SUCCEEDED(accel->Service->GetDecoderDeviceGuids(&guidcount, &guids))) {
+		for (int m = 0; modes[m] != NULL && !found; m++) {
+			for (UINT g = 0; g < guidcount && !found; g++) {
+				if (!IsEqualGUID(*modes[m], guids[g]))
+					continue;
+				UINT formatcount = 0;
+				D3DFORMAT* formats = NULL;
+				if (SUCCEEDED(accel->Service->GetDecoderRenderTargets(guids[g], &formatcount, &formats))) {
+					for (UINT f = 0; f < formatcount; f++) {
+						if (formats[f] == (D3DFORMAT)MAKEFOURCC('N', 'V', '1', '2')) {
+							accel->Mode = guids[g];
+							found = true;
+						}
+					}
+					CoTaskMemFree(formats);
+				}
+			}
+		}
+		CoTaskMemFree(guids);
+	}
+	if (!found) {
+		HWAccelClose(accel);
+		return NULL;
+	}
+
+	// Hardware decoding is chosen by the decoder through get_format. The DXVA2 hwaccel submits each picture from the
+	// thread that called get_buffer, which frame threading breaks, so only frame threading is turned off. Slice
+	// threading, and the thread count, are left as requested.
+	Codec->opaque = accel;
+	Codec->get_format = _GetFormat;
+	Codec->get_buffer = _GetBuffer;
+	Codec->release_buffer = _ReleaseBuffer;
+	Codec->thread_type &= ~FF_THREAD_FRAME;
+	return accel;
+}
+
+bool HWAccelActive(HWAccel* Accel) {
+	return Accel->Active;
+}
+
+bool HWAccelRetrieve(HWAccel* Accel, AVFrame* Picture, int Height, uint8_t** Data, int* Linesize) {
+	IDirect3DSurface9* surface = (IDirect3DSurface9*)Picture->data[3];
+	D3DSURFACE_DESC desc;
+	D3DLOCKED_RECT rect;
+	if (FAILED(surface->GetDesc(&desc)) || FAILED(surface->LockRect(&rect, NULL, D3DLOCK_READONLY)))
+		return false;
+
+	// The chroma plane of NV12 follows the luma plane, at half height. Surfaces are allocated at an aligned height, so
+	// the chroma plane starts after the aligned luma plane, but only the rows of the picture are copied.
+	int height = Height < (int)desc.Height ? Height : (int)desc.Height;
+	int lumasize = rect.Pitch * height;
+	int chromasize = rect.Pitch * ((height + 1) / 2);
+	int size = lumasize + chromasize;
+	if (size > Accel->CopySize) {
+		av_free(Accel->Copy);
+		Accel->Copy = (uint8_t*)av_malloc(size);
+		Accel->CopySize = size;
+	}
+	memcpy(Accel->Copy, rect.pBits, lumasize);
+	memcpy(Accel->Copy + lumasize, (uint8_t*)rect.pBits + rect.Pitch * desc.Height, chromasize);
+	surface->UnlockRect();
+
+	Data[0] = Accel->Copy;
+	Data[1] = Accel->Copy + lumasize;
+	Linesize[0] = rect.Pitch;
+	Linesize[1] = rect.Pitch;
+	return true;
+}
+
+void HWAccelClose(HWAccel* Accel) {
+	_ReleaseDecoder(Accel);
+	if (Accel->Service != NULL)
+		Accel->Service->Release();
+	if (Accel->Device != NULL)
+		Accel->Device->Release();
+	if (Accel->D3D != NULL)
+		Accel->D3D->Release();
+	if (Accel->DXVA2Library != NULL)
+		FreeLibrary(Accel->DXVA2Library);
+	if (Accel->D3D9Library != NULL)
+		FreeLibrary(Accel->D3D9Library);
+	av_free(Accel->Copy);
+	delete Accel;
+}
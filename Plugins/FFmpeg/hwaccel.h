@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+
+struct AVCodecContext;
+struct AVFrame;
+
+/// <summary>
+/// The state of DXVA2 hardware decoding for a codec context.
+/// </summary>
+struct HWAccel;
+
+/// <summary>
+/// Prepares a codec context, before it is opened, to decode with DXVA2 when the decoder offers it. Returns NULL if
+/// DXVA2 is not available on this machine or for the codec, in which case the codec context is left unchanged.
+/// </summary>
+HWAccel* HWAccelInit(AVCodecContext* Codec);
+
+/// <summary>
+/// Gets wether the decoder for an accelerated codec context chose hardware decoding. This is only known once the first
+/// picture has been decoded.
+/// </summary>
+bool HWAccelActive(HWAccel* Accel);
+
+/// <summary>
+/// Reads back the surface of a hardware-decoded picture as NV12 planes of the given height into memory owned by the
+/// accelerator, and gives pointers to them. The planes are valid until the next picture is read back. Returns false if
+/// the surface can not be read.
+/// </summary>
+bool HWAccelRetrieve(HWAccel* Accel, AVFrame* Picture, int Height, uint8_t** Data, int* Linesize);
+
+/// <summary>
+/// Releases all resources for hardware decoding. The codec context must be closed first.
+/// </summary>
+void HWAccelClose(HWAccel* Accel);
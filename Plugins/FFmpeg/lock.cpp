@@ -0,0 +1,33 @@
+#include <windows.h>
+extern "C" {
+	#include "libavcodec/avcodec.h"
+}
+#include "lock.h"
+
+static int _LockManager(void** Mutex, enum AVLockOp Op) {
+	CRITICAL_SECTION* section = (CRITICAL_SECTION*)*Mutex;
+	switch (Op) {
+	case AV_LOCK_CREATE:
+		section = new CRITICAL_SECTION();
+		InitializeCriticalSection(section);
+		*Mutex = section;
+		return 0;
+	case AV_LOCK_OBTAIN:
+		EnterCriticalSection(section);
+		return 0;
+	case AV_LOCK_RELEASE:
+		LeaveCriticalSection(section);
+		return 0;
+	case AV_LOCK_DESTROY:
+		DeleteCriticalSection(section);
+		delete section;
+		*Mutex = NULL;
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+bool RegisterLockManager() {
+	return av_lockmgr_register(&_LockManager) == 0;
+}
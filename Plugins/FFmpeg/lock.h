@@ -0,0 +1,7 @@
+#pragma once
+
+/// <summary>
+/// Registers a lock manager with FFmpeg, so that codecs may be opened and closed from several threads at once. Returns
+/// false if the lock manager could not be registered.
+/// </summary>
+bool RegisterLockManager();
@@ -1,4 +1,6 @@
 extern "C" {
 	#include "libavcodec/avcodec.h"
 	#include "libavformat/avformat.h"
+	#include "libavutil/fifo.h"
+	#include "libavutil/imgutils.h"
 }
\ No newline at end of file
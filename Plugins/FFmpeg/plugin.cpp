@@ -1,62 +1,382 @@
 #include "pch.h"
 #include "plugin.h"
 
-AVIOContext* InitStreamContext(ExclusiveByteStream^ Context) {
-	gcroot<ExclusiveByteStream^>* context = new gcroot<ExclusiveByteStream^>(Context);
-	return avio_alloc_context(NULL, 65536, 0, context, &read_packet, NULL, NULL);
+_StreamSource::_StreamSource(ExclusiveByteStream Stream) {
+	this->_Stream = Stream;
+	this->_Data = nullptr;
+	this->_Owned = nullptr;
+	this->_Position = 0;
+	this->_Transfer = nullptr;
+}
+
+_StreamSource::_StreamSource(ByteData^ Data, IDisposable^ Owned) {
+	this->_Data = Data;
+	this->_Owned = Owned;
+	this->_Position = 0;
+	this->_Transfer = nullptr;
+}
+
+int _StreamSource::Read(uint8_t* Buffer, int Size) {
+	if (this->_Data != nullptr)
+		return this->_ReadData(Buffer, Size);
+	else
+		return this->_ReadStream(Buffer, Size);
+}
+
+int _StreamSource::_ReadStream(uint8_t* Buffer, int Size) {
+	ByteStream^ stream = this->_Stream.Object;
+
+	// Copy directly from buffer streams.
+	BufferStream<Byte>^ bufferstream = dynamic_cast<BufferStream<Byte>^>(stream);
+	if (bufferstream != nullptr && bufferstream->Buffer.Stride == 1) {
+		memcpy(Buffer, bufferstream->Buffer.Start.ToPointer(), Size);
+		return bufferstream->Skip(Size);
+	}
+
+	// Copy directly from array streams.
+	ArrayStream<Byte>^ arraystream = dynamic_cast<ArrayStream<Byte>^>(stream);
+	if (arraystream != nullptr) {
+		int readsize = Math::Min(Size, arraystream->Array->Length - arraystream->Offset);
+		if (readsize > 0) {
+			pin_ptr<Byte> ptr = &arraystream->Array[arraystream->Offset];
+			memcpy(Buffer, ptr, readsize);
+		}
+		return arraystream->Skip(readsize);
+	}
+
+	// Read through the transfer buffer.
+	if (this->_Transfer == nullptr)
+		this->_Transfer = gcnew array<Byte>(StreamBufferSize);
+	int totalsize = 0;
+	while (totalsize < Size) {
+		int chunksize = Math::Min(Size - totalsize, this->_Transfer->Length);
+		int readsize = stream->Read(this->_Transfer, 0, chunksize);
+		if (readsize > 0) {
+			pin_ptr<Byte> ptr = &this->_Transfer[0];
+			memcpy(Buffer + totalsize, ptr, readsize);
+			totalsize += readsize;
+		}
+		if (readsize < chunksize)
+			break;
+	}
+	return totalsize;
+}
+
+int _StreamSource::_ReadData(uint8_t* Buffer, int Size) {
+	ByteData^ data = this->_Data;
+	UInt64 position = this->_Position;
+	UInt64 remaining = position < data->Size ? data->Size - position : 0;
+	int readsize = (int)Math::Min((UInt64)Size, remaining);
+	if (readsize <= 0)
+		return 0;
+
+	// Copy directly from buffer data.
+	BufferData<Byte>^ bufferdata = dynamic_cast<BufferData<Byte>^>(data);
+	if (bufferdata != nullptr && bufferdata->Buffer.Stride == 1) {
+		memcpy(Buffer, (Byte*)bufferdata->Buffer.Start.ToPointer() + position, readsize);
+		this->_Position += readsize;
+		return readsize;
+	}
+
+	// Copy directly from array data.
+	ArrayData<Byte>^ arraydata = dynamic_cast<ArrayData<Byte>^>(data);
+	if (arraydata != nullptr) {
+		pin_ptr<Byte> ptr = &arraydata->Array[arraydata->Offset + (int)position];
+		memcpy(Buffer, ptr, readsize);
+		this->_Position += readsize;
+		return readsize;
+	}
+
+	// Read through the transfer buffer.
+	if (this->_Transfer == nullptr)
+		this->_Transfer = gcnew array<Byte>(StreamBufferSize);
+	int totalsize = 0;
+	while (totalsize < readsize) {
+		int chunksize = Math::Min(readsize - totalsize, this->_Transfer->Length);
+		data->Read(position + totalsize, this->_Transfer, 0, chunksize);
+		pin_ptr<Byte> ptr = &this->_Transfer[0];
+		memcpy(Buffer + totalsize, ptr, chunksize);
+		totalsize += chunksize;
+	}
+	this->_Position += totalsize;
+	return totalsize;
+}
+
+int64_t _StreamSource::Seek(int64_t Offset, int Whence) {
+	if (this->_Data == nullptr)
+		return -1;
+
+	Int64 size = (Int64)this->_Data->Size;
+	Int64 position;
+	switch (Whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return size;
+	case SEEK_SET:
+		position = Offset;
+		break;
+	case SEEK_CUR:
+		position = (Int64)this->_Position + Offset;
+		break;
+	case SEEK_END:
+		position = size + Offset;
+		break;
+	default:
+		return -1;
+	}
+	if (position < 0)
+		return -1;
+	this->_Position = (UInt64)position;
+	return position;
+}
+
+void _StreamSource::Release() {
+	if (this->_Data == nullptr)
+		this->_Stream.Release->Invoke();
+	if (this->_Owned != nullptr)
+		delete this->_Owned;
+}
+
+AVIOContext* InitStreamContext(ExclusiveByteStream Stream) {
+	StreamContext* context = new StreamContext();
+	context->Map = NULL;
+	context->Counters = NULL;
+	context->Source = new gcroot<_StreamSource^>(gcnew _StreamSource(Stream));
+	uint8_t* buffer = _StreamBufferPool::Lease();
+	return avio_alloc_context(buffer, StreamBufferSize, 0, context, &read_packet, NULL, NULL);
+}
+
+AVIOContext* InitStreamContext(ByteData^ Data) {
+
+	// Map local files, if possible.
+	MappedData^ mapped = dynamic_cast<MappedData^>(Data);
+	IDisposable^ owned = nullptr;
+	if (mapped == nullptr) {
+		IOData^ iodata = dynamic_cast<IOData^>(Data);
+		System::IO::FileStream^ file = iodata != nullptr ? dynamic_cast<System::IO::FileStream^>(iodata->Source) : nullptr;
+		if (file != nullptr && file->Length > 0) {
+			try {
+				mapped = MappedData::FromStream(file);
+				owned = mapped;
+			} catch (Exception^) {
+				mapped = nullptr;
+			}
+		}
+	}
+
+	StreamContext* context = new StreamContext();
+	context->Map = NULL;
+	context->Counters = NULL;
+	context->Source = new gcroot<_StreamSource^>(gcnew _StreamSource(Data, owned));
+	uint8_t* buffer = _StreamBufferPool::Lease();
+	if (mapped != nullptr) {
+		context->Map = (const uint8_t*)mapped->Buffer.Start.ToPointer();
+		context->MapSize = (int64_t)mapped->Size;
+		context->MapPosition = 0;
+		return avio_alloc_context(buffer, StreamBufferSize, 0, context, &read_mapped, NULL, &seek_mapped);
+	}
+	return avio_alloc_context(buffer, StreamBufferSize, 0, context, &read_packet, NULL, &seek_packet);
 }
 
 void CloseStreamContext(AVIOContext* Context) {
-	gcroot<ExclusiveByteStream^>* stream = (gcroot<ExclusiveByteStream^>*)Context->opaque;
-	(*stream)->Release->Invoke();
-	delete stream;
+	StreamContext* context = (StreamContext*)Context->opaque;
+	(*context->Source)->Release();
+	delete context->Source;
+	delete context;
+	_StreamBufferPool::Return(Context->buffer, Context->buffer_size);
 	av_free(Context);
 }
 
+uint8_t* _StreamBufferPool::Lease() {
+	Monitor::Enter(_Buffers);
+	try {
+		if (_Buffers->Count > 0)
+			return (uint8_t*)_Buffers->Pop().ToPointer();
+	} finally {
+		Monitor::Exit(_Buffers);
+	}
+	return (uint8_t*)av_malloc(StreamBufferSize);
+}
+
+void _StreamBufferPool::Return(uint8_t* Buffer, int Size) {
+
+	// Probing may replace the buffer of a context with a buffer of another size.
+	if (Size == StreamBufferSize) {
+		Monitor::Enter(_Buffers);
+		try {
+			if (_Buffers->Count < MaxPooledStreamBuffers) {
+				_Buffers->Push(IntPtr(Buffer));
+				return;
+			}
+		} finally {
+			Monitor::Exit(_Buffers);
+		}
+	}
+	av_free(Buffer);
+}
+
 int read_packet(void* opaque, uint8_t* buf, int buf_size) {
-	ExclusiveByteStream^ stream = *(gcroot<ExclusiveByteStream^>*)opaque;
-	array<Byte>^ temparray = gcnew array<Byte>(buf_size);
-	int readsize = stream->Object->Read(temparray, 0, buf_size);
-	pin_ptr<Byte> ptr = &temparray[0];
-	memcpy(buf, ptr, readsize);
+	StreamContext* context = (StreamContext*)opaque;
+	_StreamSource^ source = *context->Source;
+	if (context->Counters == NULL)
+		return source->Read(buf, buf_size);
+	int64_t start = CounterNow();
+	int readsize = source->Read(buf, buf_size);
+	CountRead(context->Counters, start, readsize);
+	return readsize;
+}
+
+int64_t seek_packet(void* opaque, int64_t offset, int whence) {
+	_StreamSource^ source = *((StreamContext*)opaque)->Source;
+	return source->Seek(offset, whence);
+}
+
+#pragma managed(push, off)
+
+int read_mapped(void* opaque, uint8_t* buf, int buf_size) {
+	StreamContext* context = (StreamContext*)opaque;
+	int64_t start = context->Counters != NULL ? CounterNow() : 0;
+	int64_t remaining = context->MapSize - context->MapPosition;
+	int readsize = remaining < buf_size ? (int)remaining : buf_size;
+	if (readsize < 0)
+		readsize = 0;
+	if (readsize > 0) {
+		memcpy(buf, context->Map + context->MapPosition, readsize);
+		context->MapPosition += readsize;
+	}
+	if (context->Counters != NULL)
+		CountRead(context->Counters, start, readsize);
 	return readsize;
 }
 
+int64_t seek_mapped(void* opaque, int64_t offset, int whence) {
+	StreamContext* context = (StreamContext*)opaque;
+	int64_t position;
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return context->MapSize;
+	case SEEK_SET:
+		position = offset;
+		break;
+	case SEEK_CUR:
+		position = context->MapPosition + offset;
+		break;
+	case SEEK_END:
+		position = context->MapSize + offset;
+		break;
+	default:
+		return -1;
+	}
+	if (position < 0)
+		return -1;
+	context->MapPosition = position;
+	return position;
+}
+
+#pragma managed(pop)
+
 _Context::_Context(array<MD::Content^>^ Content) : Context(Content) {
-	this->_Packet = NULL;
+	this->_Packet = new AVPacket();
+	av_init_packet(this->_Packet);
+	this->_Packet->data = NULL;
+	this->_Packet->size = 0;
+	this->_Pending = new AVPacket();
+	*this->_Pending = *this->_Packet;
+	this->_EndOfStream = false;
+	this->_FlushStream = 0;
+	this->_Output = NULL;
+	this->_OutputSize = 0;
+	this->_Picture = avcodec_alloc_frame();
+	this->_SeekTables = nullptr;
+	this->_IndexChanged = false;
+	this->_SeekIndex = nullptr;
+	this->_IndexPath = nullptr;
+	this->_Cache = NULL;
+	this->_CacheWriters = nullptr;
+	this->_Summaries = NULL;
+	this->_SummaryTransfer = nullptr;
+	this->_Counters = new ContextCounters();
+	this->_Returned = 0;
+	this->_CountConsume = true;
 	this->_Disposed = false;
 }
 
 _Context::~_Context() {
+
+	// Files are only written or removed when disposed, as the finalizer thread must not do file I/O.
+	if (!this->_Disposed) {
+		if (this->_IndexChanged) {
+			Dictionary<int, SeekTable^>^ tables = gcnew Dictionary<int, SeekTable^>();
+			for (int t = 0; t < this->_SeekTables->Length; t++) {
+				if (this->_SeekTables[t] != nullptr && this->_SeekTables[t]->Count > 0)
+					tables[t] = this->_SeekTables[t];
+			}
+			this->_SeekIndex->Save(this->_IndexPath, tables);
+		}
+		this->_StopCaching();
+	}
 	this->!_Context();
 }
 
 _Context::!_Context() {
 	if (!this->_Disposed) {
 		this->_Disposed = true;
+		delete[] this->_Cache;
+		this->_StopSummarizing();
+		delete[] this->_Summaries;
 		CloseStreamContext(this->_IOContext);
 		delete[] this->_StreamContent;
+		delete[] this->_ContentStream;
+		delete[] this->_StreamTime;
+		delete[] this->_Ignored;
 		av_free(this->_Buffer);
-		if (this->_Packet != NULL)
-		{
-			av_free_packet(this->_Packet);
-			delete this->_Packet;
+		av_free(this->_Output);
+		this->_ResetResamplers();
+		delete[] this->_Resample;
+		av_free(this->_Picture);
+		for (unsigned int t = 0; t < this->_FormatContext->nb_streams; t++) {
+			if (this->_HWAccel[t] != NULL) {
+				avcodec_close(this->_FormatContext->streams[t]->codec);
+				HWAccelClose(this->_HWAccel[t]);
+			}
 		}
+		delete[] this->_HWAccel;
+		delete[] this->_StreamSamples;
+		delete[] this->_SkipSamples;
+		delete[] this->_Indexing;
+		av_free_packet(this->_Packet);
+		delete this->_Packet;
+		delete this->_Pending;
+		delete this->_Counters;
 	}
 }
 
-ExclusiveContext _Context::Initialize(AVIOContext* IOContext, AVFormatContext* FormatContext) {
+ExclusiveContext _Context::Initialize(AVIOContext* IOContext, AVFormatContext* FormatContext, DecodeParameters^ Parameters, String^ Path) {
 
 	// Initialize content streams
 	List<MD::Content^>^ contents = gcnew List<MD::Content^>(FormatContext->nb_streams);
 	int* streamcontent = new int[FormatContext->nb_streams];
+	int* contentstream = new int[FormatContext->nb_streams];
+	double* streamtime = new double[FormatContext->nb_streams];
+	HWAccel** hwaccel = new HWAccel*[FormatContext->nb_streams];
+	int64_t* streamsamples = new int64_t[FormatContext->nb_streams];
+	int64_t* skipsamples = new int64_t[FormatContext->nb_streams];
+	bool* indexing = new bool[FormatContext->nb_streams];
 	int buffersize = 0;
 
 	for (unsigned int t = 0; t < FormatContext->nb_streams; t++) {
 		streamcontent[t] = -1;
+		streamtime[t] = 0.0;
+		hwaccel[t] = NULL;
+		streamsamples[t] = 0;
+		skipsamples[t] = 0;
+		indexing[t] = false;
 		AVCodecContext* codeccontext = FormatContext->streams[t]->codec;
 		AVCodec* codec = avcodec_find_decoder(codeccontext->codec_id);
 		if (codec != NULL) {
+			codeccontext->thread_count = Parameters->ThreadCount;
+			codeccontext->thread_type = (int)Parameters->DecodeThreading;
+			if (Parameters->HardwareVideo && codeccontext->codec_type == AVMEDIA_TYPE_VIDEO)
+				hwaccel[t] = HWAccelInit(codeccontext);
 			if (avcodec_open(codeccontext, codec) >= 0) {
 				switch (codeccontext->codec_type) {
 
@@ -66,9 +386,32 @@ ExclusiveContext _Context::Initialize(AVIOContext* IOContext, AVFormatContext* F
 					int samplerate = codeccontext->sample_rate;
 					int channels = codeccontext->channels;
 					int bps = AudioContent::BytesPerSample(format);
+					AudioContent^ audio = gcnew AudioContent(samplerate, channels, format);
+					audio->Codec = gcnew _Codec(FormatContext->streams[t]);
+
+					// Estimate the length of the content from the duration of its stream, or of the whole container.
+					AVStream* stream = FormatContext->streams[t];
+					if (stream->duration != AV_NOPTS_VALUE)
+						audio->SampleCount = (int64_t)(stream->duration * av_q2d(stream->time_base) * samplerate);
+					else if (FormatContext->duration != AV_NOPTS_VALUE)
+						audio->SampleCount = FormatContext->duration * samplerate / AV_TIME_BASE;
+
+					streamcontent[t] = contents->Count;
+					contentstream[contents->Count] = t;
+					contents->Add(audio);
+					} break;
+
+				// Video content, which is ignored until requested
+				case AVMEDIA_TYPE_VIDEO: {
+					AVRational framerate = FormatContext->streams[t]->r_frame_rate;
+					VideoContent^ video = gcnew VideoContent(codeccontext->width, codeccontext->height,
+						(VideoFormat)codeccontext->pix_fmt, framerate.den != 0 ? av_q2d(framerate) : 0.0);
+					video->Ignore = true;
+					video->Codec = gcnew _Codec(FormatContext->streams[t]);
 
 					streamcontent[t] = contents->Count;
-					contents->Add(gcnew AudioContent(samplerate, channels, format));
+					contentstream[contents->Count] = t;
+					contents->Add(video);
 					} break;
 				default:
 					break;
@@ -77,180 +420,2132 @@ ExclusiveContext _Context::Initialize(AVIOContext* IOContext, AVFormatContext* F
 		}
 	}
 
+	// Discard packets for streams without content.
+	bool* ignored = new bool[contents->Count];
+	for (unsigned int t = 0; t < FormatContext->nb_streams; t++) {
+		if (streamcontent[t] == -1)
+			FormatContext->streams[t]->discard = AVDISCARD_ALL;
+	}
+	_ResampleState* resample = new _ResampleState[contents->Count];
+	for (int t = 0; t < contents->Count; t++) {
+		ignored[t] = false;
+		resample[t].Context = NULL;
+	}
+
 	// Set lower bound on buffer size.
 	buffersize = Math::Max(buffersize, AVCODEC_MAX_AUDIO_FRAME_SIZE);
 
 	// Create output context
 	_Context^ context = gcnew _Context(contents->ToArray());
 	context->_StreamContent = streamcontent;
+	context->_ContentStream = contentstream;
+	context->_StreamTime = streamtime;
+	context->_Ignored = ignored;
+	context->_Resample = resample;
+	context->_HWAccel = hwaccel;
+	context->_StreamSamples = streamsamples;
+	context->_SkipSamples = skipsamples;
+	context->_Indexing = indexing;
+
+	// Cache the samples of audio content decoded from the start of the file.
+	DecodeCache^ decodecache = Parameters->DecodeCache != nullptr ? Parameters->DecodeCache->Value : nullptr;
+	if (decodecache != nullptr && Path != nullptr) {
+		context->_Cache = new _CacheState[contents->Count];
+		context->_CacheWriters = gcnew array<DecodeCacheWriter^>(contents->Count);
+		for (int t = 0; t < contents->Count; t++) {
+			AudioContent^ audio = dynamic_cast<AudioContent^>(contents[t]);
+			context->_Cache[t].Active = audio != nullptr;
+			if (audio != nullptr)
+				audio->CacheSource = gcnew DecodeCacheSource(decodecache, Path, t);
+		}
+	}
+
+	// Summarize audio content decoded from the start of the file, unless a summary is already stored.
+	if (Parameters->SummaryBlockSize > 0) {
+		context->_Summaries = new SampleSummary*[contents->Count];
+		for (int t = 0; t < contents->Count; t++) {
+			context->_Summaries[t] = NULL;
+			AudioContent^ audio = dynamic_cast<AudioContent^>(contents[t]);
+			if (audio == nullptr || AudioContent::BytesPerSample(audio->Format) == 0)
+				continue;
+			if (audio->CacheSource != nullptr) {
+				FSharpOption<AudioSummary^>^ stored = audio->CacheSource->TryLoadSummary();
+				if (stored != nullptr && stored->Value->Channels == audio->Channels) {
+					audio->Summary = stored->Value;
+					continue;
+				}
+			}
+			audio->Summary = gcnew AudioSummary(audio->Channels, Parameters->SummaryBlockSize);
+			context->_Summaries[t] = SummaryCreate(audio->Channels, Parameters->SummaryBlockSize);
+		}
+	}
+
+	// Index audio streams from the start of the file, continuing from any stored tables.
+	SeekIndex^ seekindex = Parameters->SeekIndex != nullptr ? Parameters->SeekIndex->Value : nullptr;
+	if (seekindex != nullptr && Path != nullptr) {
+		FSharpOption<Dictionary<int, SeekTable^>^>^ stored = seekindex->TryLoad(Path);
+		context->_SeekTables = gcnew array<SeekTable^>(FormatContext->nb_streams);
+		context->_SeekIndex = seekindex;
+		context->_IndexPath = Path;
+		for (unsigned int t = 0; t < FormatContext->nb_streams; t++) {
+			AVCodecContext* codeccontext = FormatContext->streams[t]->codec;
+			if (streamcontent[t] == -1 || codeccontext->codec_type != AVMEDIA_TYPE_AUDIO)
+				continue;
+			SeekTable^ table;
+			if (stored == nullptr || !stored->Value->TryGetValue(t, table) || table->SampleRate != codeccontext->sample_rate)
+				table = gcnew SeekTable(codeccontext->sample_rate);
+			context->_SeekTables[t] = table;
+			indexing[t] = true;
+		}
+	}
+	context->_SkipIgnored = Parameters->SkipIgnored;
 	context->_IOContext = IOContext;
 	context->_FormatContext = FormatContext;
+	((StreamContext*)IOContext->opaque)->Counters = context->_Counters;
 	context->_Buffer = (Byte*)av_malloc(buffersize);
 	context->_BufferSize = buffersize;
 
+	// Decode on a background thread if requested.
+	if (Parameters->ReadAheadFrames > 0)
+		return Exclusive::dispose<Context^>(gcnew _ReadAheadContext(context, Parameters->ReadAheadFrames, Parameters->ReadAheadTime));
+
 	return Exclusive::dispose<Context^>(context);
 }
 
 bool _Context::NextFrame(int% ContentIndex) {
-	if (this->_Packet == NULL)
-		this->_Packet = new AVPacket();
-	else
-		av_free_packet(this->_Packet);
-	while (av_read_frame(this->_FormatContext, this->_Packet) >= 0) {
-		int streamindex = this->_Packet->stream_index;
-		ContentIndex = this->_StreamContent[streamindex];
-		if (ContentIndex != -1) {
-			MD::Content^ content = this->Content[ContentIndex];
-			if (!content->Ignore) {
-				AVCodecContext* codeccontext = this->_FormatContext->streams[streamindex]->codec;
-				int framesize = this->_BufferSize;
+	this->_BeginCall();
+	bool read = this->_Read(ContentIndex, false);
+	this->_EndCall();
+	return read;
+}
 
-				AudioContent^ audio = dynamic_cast<AudioContent^>(content);
-				if (audio != nullptr) {
+/// <summary>
+/// Ensures that all content other than audio is ignored, as Context.NextFrames only gives audio frames.
+/// </summary>
+void _CheckBatch(array<MD::Content^>^ Content) {
+	for (int t = 0; t < Content->Length; t++) {
+		if (dynamic_cast<AudioContent^>(Content[t]) == nullptr && !Content[t]->Ignore)
+			throw gcnew InvalidOperationException(
+				"Frames can only be read in batches when all content other than audio is ignored.");
+	}
+}
+
+int _Context::NextFrames(int MaxFrames, int MaxBytes) {
+	array<MD::Content^>^ content = this->Content;
+	_CheckBatch(content);
+	this->_BeginCall();
+	for (int t = 0; t < content->Length; t++) {
+		AudioContent^ audio = dynamic_cast<AudioContent^>(content[t]);
+		if (audio != nullptr)
+			audio->Block->Clear();
+	}
+
+	// Decode directly into the blocks for each content.
+	int frames = 0;
+	int bytes = 0;
+	int contentindex;
+	while (frames < MaxFrames && bytes < MaxBytes && this->_Read(contentindex, true)) {
+		AudioContent^ audio = dynamic_cast<AudioContent^>(content[contentindex]);
+		if (audio != nullptr && !audio->Ignore) {
+			AudioBlock^ block = audio->Block;
+			bytes += block->FrameSize(block->Frames - 1);
+			frames++;
+		}
+	}
+
+	for (int t = 0; t < content->Length; t++) {
+		AudioContent^ audio = dynamic_cast<AudioContent^>(content[t]);
+		if (audio != nullptr && audio->Block->Frames > 0)
+			audio->Data = audio->Block->DataOption;
+	}
+	this->_EndCall();
+	return frames;
+}
+
+bool _Context::_Read(int% ContentIndex, bool Batch) {
+	while (true) {
+
+		// Decode all frames remaining in the current packet before reading another.
+		if (this->_Pending->size > 0) {
+			int streamindex = this->_Pending->stream_index;
+			int contentindex = this->_StreamContent[streamindex];
+			AudioContent^ audio = dynamic_cast<AudioContent^>(this->Content[contentindex]);
+			VideoContent^ video = dynamic_cast<VideoContent^>(this->Content[contentindex]);
+			if (audio != nullptr && !audio->Ignore) {
+				if (this->_DecodeAudio(audio, streamindex, this->_Pending, Batch)) {
+					ContentIndex = contentindex;
+					return true;
+				}
+			} else if (video != nullptr && !video->Ignore) {
+				if (this->_DecodeVideo(video, streamindex, this->_Pending)) {
+					ContentIndex = contentindex;
+					return true;
+				}
+			} else {
+				this->_Pending->size = 0;
+				this->_Counters->PacketsDiscarded++;
+			}
+			continue;
+		}
+
+		// Read the next packet.
+		if (!this->_EndOfStream) {
+			this->_UpdateDiscard();
+			av_free_packet(this->_Packet);
+			if (this->_ReadPacket()) {
+				int streamindex = this->_Packet->stream_index;
+				int contentindex = this->_StreamContent[streamindex];
+				if (contentindex == -1) {
+					this->_Counters->PacketsDiscarded++;
+					continue;
+				}
+				if (this->Content[contentindex]->Ignore) {
+					if (this->_SkipIgnored) {
+						this->_Counters->PacketsDiscarded++;
+						continue;
+					}
+					ContentIndex = contentindex;
+					return true;
+				}
 
-					// Decode audio
-					if (avcodec_decode_audio3(codeccontext, (int16_t*)this->_Buffer, &framesize, this->_Packet) >= 0) {
-						audio->Data = FSharpOption<MD::Data<Byte>^>::Some(gcnew BufferData<Byte>(MD::Buffer<Byte>::FromPointer((IntPtr)this->_Buffer), framesize));
+				this->_UpdateTime(streamindex, this->_Packet);
+				this->_IndexPacket(streamindex, this->_Packet);
+				*this->_Pending = *this->_Packet;
+				continue;
+			}
+			this->_EndOfStream = true;
+			this->_FlushStream = 0;
+		}
+
+		// Drain decoders that delay their output once there are no more packets.
+		while (this->_FlushStream < this->_FormatContext->nb_streams) {
+			int streamindex = this->_FlushStream;
+			int contentindex = this->_StreamContent[streamindex];
+			if (contentindex != -1) {
+				AVCodecContext* codeccontext = this->_FormatContext->streams[streamindex]->codec;
+				MD::Content^ content = this->Content[contentindex];
+				if (!content->Ignore && (codeccontext->codec->capabilities & CODEC_CAP_DELAY)) {
+					AVPacket flush;
+					av_init_packet(&flush);
+					flush.data = NULL;
+					flush.size = 0;
+					AudioContent^ audio = dynamic_cast<AudioContent^>(content);
+					VideoContent^ video = dynamic_cast<VideoContent^>(content);
+					if ((audio != nullptr && this->_DecodeAudio(audio, streamindex, &flush, Batch)) ||
+						(video != nullptr && this->_DecodeVideo(video, streamindex, &flush))) {
+						ContentIndex = contentindex;
 						return true;
 					}
+				}
 
-					continue;
+				// Resampled content ends with the samples the resampler holds back, once the decoder is drained.
+				AudioContent^ audio = dynamic_cast<AudioContent^>(content);
+				if (audio != nullptr && !audio->Ignore && this->_DrainResampler(audio, streamindex, Batch)) {
+					ContentIndex = contentindex;
+					return true;
 				}
-			} else {
-				return true;
 			}
+			this->_FlushStream++;
 		}
+		this->_CommitCache();
+		this->_FinishSummaries();
+		return false;
 	}
-	return false;
 }
 
-FSharpOption<ExclusiveContext>^ _Container::Decode(ExclusiveByteStream Stream) {
-	if (this->Input == NULL)
-		return FSharpOption<ExclusiveContext>::None;
+bool _Context::NextPacket(ContentPacket^ Packet) {
+	this->_BeginCall();
+	this->_Pending->size = 0;
+	this->_StopIndexing();
+	this->_StopCaching();
+	this->_StopSummarizing();
+	while (true) {
+		this->_UpdateDiscard();
+		av_free_packet(this->_Packet);
+		if (!this->_ReadPacket()) {
+			this->_EndOfStream = true;
+			this->_FlushStream = 0;
+			this->_EndCall();
+			return false;
+		}
+		int streamindex = this->_Packet->stream_index;
+		int contentindex = this->_StreamContent[streamindex];
+		if (contentindex == -1 || this->Content[contentindex]->Ignore) {
+			this->_Counters->PacketsDiscarded++;
+			continue;
+		}
 
-	AVIOContext* io = InitStreamContext(Stream);
-		
-	// Find stream format information
-	AVFormatContext* formatcontext = NULL;
-	int err = av_open_input_stream(&formatcontext, io, "", this->Input, NULL);
-	if (err != 0)
-	{
-		CloseStreamContext(io);
-		return FSharpOption<ExclusiveContext>::None;
+		// The packet references the data read by FFmpeg, which stays valid until the next packet is read.
+		AVStream* stream = this->_FormatContext->streams[streamindex];
+		this->_UpdateTime(streamindex, this->_Packet);
+		Packet->Update(MD::Buffer<Byte>::FromPointer((IntPtr)this->_Packet->data), this->_Packet->size, contentindex,
+			this->_Packet->pts, this->_Packet->dts, this->_Packet->duration,
+			stream->time_base.num, stream->time_base.den, (this->_Packet->flags & AV_PKT_FLAG_KEY) != 0);
+		this->_EndCall();
+		return true;
 	}
+}
 
-	err = av_find_stream_info(formatcontext);
-	if (err < 0)
-	{
-		av_close_input_stream(formatcontext);
-		CloseStreamContext(io);
-		return FSharpOption<ExclusiveContext>::None;
+ContextStats^ _Context::Stats::get() {
+	ContextCounters* counters = this->_Counters;
+	double frequency = (double)CounterFrequency();
+	return gcnew ContextStats(counters->BytesRead, counters->Reads, counters->PacketsDemuxed, counters->PacketsDiscarded,
+		counters->FramesDecoded, counters->Ticks[PhaseRead] / frequency, counters->Ticks[PhaseDemux] / frequency,
+		counters->Ticks[PhaseDecode] / frequency, counters->Ticks[PhaseConsume] / frequency);
+}
+
+bool _Context::_ReadPacket() {
+	ContextCounters* counters = this->_Counters;
+	int64_t reading = counters->Ticks[PhaseRead];
+	int64_t start = CounterNow();
+	bool read = av_read_frame(this->_FormatContext, this->_Packet) >= 0;
+	int64_t duration = CounterNow() - start;
+
+	// Reads made by the demuxer are counted by the callbacks of the stream context, and traced here as one event.
+	int64_t readduration = counters->Ticks[PhaseRead] - reading;
+	if (readduration > 0)
+		this->_Trace(PhaseRead, start, readduration);
+	counters->Ticks[PhaseDemux] += duration - readduration;
+	this->_Trace(PhaseDemux, start, duration - readduration);
+	if (read)
+		counters->PacketsDemuxed++;
+	return read;
+}
+
+void _Context::_BeginCall() {
+	if (this->_Returned == 0 || !this->_CountConsume)
+		return;
+	int64_t duration = CounterNow() - this->_Returned;
+	this->_Counters->Ticks[PhaseConsume] += duration;
+	this->_Trace(PhaseConsume, this->_Returned, duration);
+}
+
+void _Context::_EndCall() {
+	this->_Returned = CounterNow();
+}
+
+void _Context::_CountDecode(int64_t Start, bool Decoded) {
+	int64_t duration = CounterNow() - Start;
+	this->_Counters->Ticks[PhaseDecode] += duration;
+	if (Decoded)
+		this->_Counters->FramesDecoded++;
+	this->_Trace(PhaseDecode, Start, duration);
+}
+
+void _Context::_Trace(int Phase, int64_t Start, int64_t Duration) {
+	int64_t events = ++this->_Counters->Events[Phase];
+	ContextTraceAction^ trace = this->Trace;
+	if (trace != nullptr && events % this->TraceInterval == 0)
+		trace->Invoke((ContextPhase)Phase, Start, Duration);
+}
+
+void _Context::_UpdateTime(int StreamIndex, AVPacket* Packet) {
+
+	// Indexed streams are timed by the samples decoded from them, as packet timestamps may not be known after seeking.
+	if (this->_Indexing[StreamIndex])
+		return;
+	AVStream* stream = this->_FormatContext->streams[StreamIndex];
+	int64_t timestamp = Packet->pts != AV_NOPTS_VALUE ? Packet->pts : Packet->dts;
+	if (timestamp != AV_NOPTS_VALUE) {
+		if (stream->start_time != AV_NOPTS_VALUE)
+			timestamp -= stream->start_time;
+		this->_StreamTime[StreamIndex] = timestamp * av_q2d(stream->time_base);
 	}
+}
 
-	return FSharpOption<ExclusiveContext>::Some(_Context::Initialize(io, formatcontext));
+void _Context::_IndexPacket(int StreamIndex, AVPacket* Packet) {
+	if (!this->_Indexing[StreamIndex] || Packet->pos < 0 || !(Packet->flags & AV_PKT_FLAG_KEY))
+		return;
+	SeekTable^ table = this->_SeekTables[StreamIndex];
+	if (table->Add(this->_StreamSamples[StreamIndex], Packet->pos, (int64_t)(table->SampleRate * SeekIndexInterval)))
+		this->_IndexChanged = true;
 }
 
-FSharpOption<ExclusiveByteStream>^ _Container::Encode(ExclusiveContext Context) {
-	return FSharpOption<ExclusiveByteStream>::None;
+void _Context::_StopIndexing() {
+	for (unsigned int t = 0; t < this->_FormatContext->nb_streams; t++)
+		this->_Indexing[t] = false;
 }
 
-MD::Action^ ::Plugin::Load() {
-	if (!Initialized)
-	{
-		Initialized = true;
-		avcodec_init();
-		av_register_all();
-
-		// Create containers
-		_Containers = gcnew Dictionary<String^, _Container^>();
-
-		// Add input formats
-		AVInputFormat* iformat = av_iformat_next(NULL);
-		while (iformat != NULL) {
-			String^ name = gcnew String(iformat->name);
-			_Container^ container = gcnew _Container(name);
-			container->Input = iformat;
-			_Containers[name] = container;
-			iformat = av_iformat_next(iformat);
-		}
-
-		// Add output formats
-		AVOutputFormat* oformat = av_oformat_next(NULL);
-		while (oformat != NULL) {
-			String^ name = gcnew String(oformat->name);
-			_Container^ container;
-			if (!_Containers->TryGetValue(name, container)) {
-				container = gcnew _Container(name);
-				_Containers->Add(name, container);
-			}
-			container->Output = oformat;
-			oformat = av_oformat_next(oformat);
+void _Context::_CacheFrame(int ContentIndex, AudioContent^ Audio, Byte* Data, int Size) {
+	if (this->_Cache == NULL || !this->_Cache[ContentIndex].Active)
+		return;
+	_CacheState* state = &this->_Cache[ContentIndex];
+	DecodeCacheWriter^ writer = this->_CacheWriters[ContentIndex];
+	int format = (int)Audio->OutputFormat;
+	int samplerate = (int)Audio->OutputSampleRate;
+	int channels = Audio->OutputChannels;
+
+	// Begin the entry with the first frame, unless the content is planar or already cached with these settings.
+	if (writer == nullptr) {
+		DecodeCacheSource^ source = Audio->CacheSource;
+		if (Audio->Planar || source->Cache->EntryFile(source->FileName, ContentIndex, Audio->OutputFormat, samplerate, channels).FileExists) {
+			state->Active = false;
+			return;
 		}
+		writer = source->Create(Audio->OutputFormat, samplerate, channels);
+		if (writer == nullptr) {
+			state->Active = false;
+			return;
+		}
+		this->_CacheWriters[ContentIndex] = writer;
+		state->Format = format;
+		state->SampleRate = samplerate;
+		state->Channels = channels;
+	} else if (Audio->Planar || format != state->Format || samplerate != state->SampleRate || channels != state->Channels) {
+		this->_StopCaching(ContentIndex);
+		return;
+	}
+	try {
+		writer->Write(IntPtr(Data), Size);
+	} catch (IO::IOException^) {
+		this->_StopCaching(ContentIndex);
 	}
+}
 
-	MD::Action^ retract = MD::Action::Nil;
+void _Context::_StopCaching(int ContentIndex) {
+	if (this->_Cache == NULL)
+		return;
+	this->_Cache[ContentIndex].Active = false;
+	DecodeCacheWriter^ writer = this->_CacheWriters[ContentIndex];
+	if (writer != nullptr) {
+		this->_CacheWriters[ContentIndex] = nullptr;
+		try {
+			writer->Abort();
+		} catch (IO::IOException^) {
+		}
+	}
+}
+
+void _Context::_StopCaching() {
+	if (this->_Cache == NULL)
+		return;
+	for (int t = 0; t < this->_CacheWriters->Length; t++)
+		this->_StopCaching(t);
+}
 
-	// Register containers
-	for each(_Container^ container in _Containers->Values) {
-		retract += MD::Container::Register(container);
+void _Context::_CommitCache() {
+	if (this->_Cache == NULL)
+		return;
+	for (int t = 0; t < this->_CacheWriters->Length; t++) {
+		DecodeCacheWriter^ writer = this->_CacheWriters[t];
+		if (writer != nullptr && this->_Cache[t].Active) {
+			this->_CacheWriters[t] = nullptr;
+			this->_Cache[t].Active = false;
+			try {
+				writer->Commit();
+			} catch (IO::IOException^) {
+			}
+		}
 	}
+}
 
-	// Register load container
-	retract += MD::Container::RegisterLoad(gcnew LoadContainerAction(_LoadContainer));
+void _Context::_Summarize(int ContentIndex, AudioContent^ Audio, const Byte* Data, int Samples) {
+	if (this->_Summaries == NULL || this->_Summaries[ContentIndex] == NULL)
+		return;
+	AudioSummary^ summary = Audio->Summary;
+	int capacity = (Samples / summary->BlockSize + 1) * summary->Channels * 3;
+	if (this->_SummaryTransfer == nullptr || this->_SummaryTransfer->Length < capacity)
+		this->_SummaryTransfer = gcnew array<float>(capacity);
+	pin_ptr<float> blocks = &this->_SummaryTransfer[0];
+	int count = SummaryAdd(this->_Summaries[ContentIndex], Data, (int)Audio->Format, Samples, blocks);
+	if (count > 0)
+		summary->Add(this->_SummaryTransfer, count);
+}
 
-	return retract;
+void _Context::_StopSummarizing(int ContentIndex) {
+	if (this->_Summaries == NULL || this->_Summaries[ContentIndex] == NULL)
+		return;
+	SummaryDestroy(this->_Summaries[ContentIndex]);
+	this->_Summaries[ContentIndex] = NULL;
+	AudioContent^ audio = (AudioContent^)this->Content[ContentIndex];
+	audio->Summary = nullptr;
 }
 
-FSharpOption<Tuple<Container^, ExclusiveContext>^>^ ::Plugin::_LoadContainer(ExclusiveByteData Data, String^ Filename) {
-	using namespace Runtime::InteropServices;
+void _Context::_StopSummarizing() {
+	if (this->_Summaries == NULL)
+		return;
+	for (int t = 0; t < this->Content->Length; t++)
+		this->_StopSummarizing(t);
+}
+
+void _Context::_FinishSummaries() {
+	if (this->_Summaries == NULL)
+		return;
+	for (int t = 0; t < this->Content->Length; t++) {
+		SampleSummary* state = this->_Summaries[t];
+		if (state == NULL)
+			continue;
+		AudioContent^ audio = (AudioContent^)this->Content[t];
+		AudioSummary^ summary = audio->Summary;
+		int capacity = summary->Channels * 3;
+		if (this->_SummaryTransfer == nullptr || this->_SummaryTransfer->Length < capacity)
+			this->_SummaryTransfer = gcnew array<float>(capacity);
+		pin_ptr<float> blocks = &this->_SummaryTransfer[0];
+		int tail = SummaryFlush(state, blocks);
+		if (tail > 0)
+			summary->Add(this->_SummaryTransfer, 1);
+		summary->Finish(tail > 0 ? tail : summary->BlockSize);
+		SummaryDestroy(state);
+		this->_Summaries[t] = NULL;
+		if (audio->CacheSource != nullptr)
+			audio->CacheSource->SaveSummary(summary);
+	}
+}
 
-	AVIOContext* io = InitStreamContext(Data.Object->Lock());
+void _Context::_UpdateDiscard() {
+	array<MD::Content^>^ content = this->Content;
+	for (int t = 0; t < content->Length; t++) {
+		bool ignore = content[t]->Ignore;
+		if (ignore != this->_Ignored[t]) {
+			this->_Ignored[t] = ignore;
+			this->_FormatContext->streams[this->_ContentStream[t]]->discard = ignore ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
 
-	// Get file name if possible
-	char* filename = NULL;
-	if (Filename != nullptr) {
-		filename = static_cast<char*>(Marshal::StringToHGlobalAnsi(Filename).ToPointer());
+			// Samples are not counted for streams that are not decoded.
+			if (ignore) {
+				this->_Indexing[this->_ContentStream[t]] = false;
+				this->_StopCaching(t);
+				this->_StopSummarizing(t);
+			}
+		}
 	}
+}
 
-	// Determine format
-	AVInputFormat* iformat = NULL;
-	int err = av_probe_input_buffer(io, &iformat, filename, NULL, 0, 0);
-	if (err != 0)
-	{
-		CloseStreamContext(io);
-		return FSharpOption<Tuple<Container^, ExclusiveContext>^>::None;
+bool _Context::_DecodeAudio(AudioContent^ Audio, int StreamIndex, AVPacket* Packet, bool Batch) {
+	AVCodecContext* codeccontext = this->_FormatContext->streams[StreamIndex]->codec;
+	int samplesize = Audio->Channels * AudioContent::BytesPerSample(Audio->Format);
+	ReSampleContext* resampler = NULL;
+	if (samplesize > 0 && ((int)Audio->OutputSampleRate != (int)Audio->SampleRate || Audio->OutputChannels != Audio->Channels))
+		resampler = this->_GetResampler(this->_StreamContent[StreamIndex], Audio);
+	bool convert = samplesize > 0 && (resampler != NULL || Audio->OutputFormat != Audio->Format || Audio->Planar);
+
+	// Decode into the block of the content when batching, into a leased frame when the content has a pool, or into
+	// the context buffer otherwise. Frames that need conversion are decoded into the context buffer first.
+	AudioFramePool^ pool = Batch ? nullptr : Audio->Pool;
+	AudioFrame^ frame = nullptr;
+	Byte* buffer;
+	if (convert) {
+		buffer = this->_Buffer;
+	} else if (Batch) {
+		buffer = (Byte*)Audio->Block->Reserve(this->_BufferSize).ToPointer();
+	} else if (pool != nullptr) {
+		frame = pool->Lease();
+		buffer = (Byte*)frame->Reserve(this->_BufferSize).ToPointer();
+	} else {
+		frame = Audio->Frame;
+		buffer = this->_Buffer;
 	}
 
-	// Free file name
-	if (filename != NULL) {
-		Marshal::FreeHGlobal(IntPtr(static_cast<void*>(filename)));
+	int framesize = this->_BufferSize;
+	int64_t start = CounterNow();
+	int used = avcodec_decode_audio3(codeccontext, (int16_t*)buffer, &framesize, Packet);
+	this->_CountDecode(start, used >= 0 && framesize > 0);
+
+	// Skip the rest of the packet if it can not be decoded.
+	if (used < 0) {
+		Packet->size = 0;
+		if (pool != nullptr && frame != nullptr)
+			frame->Return();
+		return false;
 	}
-		
-	// Find stream format information
-	AVFormatContext* formatcontext = NULL;
-	err = av_open_input_stream(&formatcontext, io, "", iformat, NULL);
-	if (err != 0)
-	{
-		CloseStreamContext(io);
-		return FSharpOption<Tuple<Container^, ExclusiveContext>^>::None;
+
+	// Advance past the consumed part of the packet. A decoder that neither consumes data nor produces output
+	// will not make progress on this packet.
+	if (used == 0 && framesize <= 0)
+		Packet->size = 0;
+	Packet->data += used;
+	Packet->size -= used;
+
+	if (framesize > 0 && samplesize > 0) {
+
+		// Discard samples before the target of an indexed seek.
+		int samples = framesize / samplesize;
+		this->_StreamSamples[StreamIndex] += samples;
+		int skip = (int)Math::Min(this->_SkipSamples[StreamIndex], (int64_t)samples);
+		if (skip > 0) {
+			this->_SkipSamples[StreamIndex] -= skip;
+			this->_StreamTime[StreamIndex] += skip / Audio->SampleRate;
+			framesize -= skip * samplesize;
+			memmove(buffer, buffer + skip * samplesize, framesize);
+		}
 	}
 
-	err = av_find_stream_info(formatcontext);
-	if (err < 0)
-	{
-		av_close_input_stream(formatcontext);
-		CloseStreamContext(io);
-		return FSharpOption<Tuple<Container^, ExclusiveContext>^>::None;
+	if (framesize > 0) {
+
+		// Advance the time of the stream by the duration of the frame, and summarize the decoded samples before they
+		// are converted.
+		double time = this->_StreamTime[StreamIndex];
+		if (samplesize > 0) {
+			this->_StreamTime[StreamIndex] += (framesize / samplesize) / Audio->SampleRate;
+			this->_Summarize(this->_StreamContent[StreamIndex], Audio, buffer, framesize / samplesize);
+		}
+
+		// Convert into the final target. Resampled frames may be up to a filter length longer or shorter than the
+		// decoded frame, as the resampler holds back samples between calls.
+		if (convert) {
+			int samples = framesize / samplesize;
+			int channels = Audio->Channels;
+			int outputsamples = samples;
+			if (resampler != NULL) {
+				channels = Audio->OutputChannels;
+				outputsamples = (int)((int64_t)samples * (int)Audio->OutputSampleRate / (int)Audio->SampleRate) + 32;
+			}
+			int outputbps = AudioContent::BytesPerSample(Audio->OutputFormat);
+			int outputsize = outputsamples * channels * outputbps;
+			bool deinterleave = resampler != NULL && Audio->Planar && channels > 1;
+			Byte* output;
+			Byte* scratch = NULL;
+			if (Batch) {
+				output = (Byte*)Audio->Block->Reserve(outputsize).ToPointer();
+			} else if (pool != nullptr) {
+				frame = pool->Lease();
+				output = (Byte*)frame->Reserve(outputsize).ToPointer();
+			} else {
+				frame = Audio->Frame;
+				output = this->_ReserveOutput(deinterleave ? outputsize * 2 : outputsize);
+				scratch = output + outputsize;
+			}
+
+			if (resampler != NULL) {
+				if (deinterleave && scratch == NULL)
+					scratch = this->_ReserveOutput(outputsize);
+				outputsamples = audio_resample(resampler, (short*)(deinterleave ? scratch : output), (short*)buffer, samples);
+				_ResampleState* state = &this->_Resample[this->_StreamContent[StreamIndex]];
+				state->InputSamples += samples;
+				state->OutputSamples += outputsamples;
+				if (deinterleave)
+					ConvertSamples(scratch, (int)Audio->OutputFormat, output, (int)Audio->OutputFormat, channels, outputsamples, true);
+			} else {
+				ConvertSamples(buffer, (int)Audio->Format, output, (int)Audio->OutputFormat, channels, samples, Audio->Planar);
+			}
+			buffer = output;
+			framesize = outputsamples * channels * outputbps;
+		}
+
+		if (framesize > 0) {
+			this->_CacheFrame(this->_StreamContent[StreamIndex], Audio, buffer, framesize);
+			if (Batch) {
+				Audio->Block->Commit(framesize, time);
+			} else {
+				frame->Update(MD::Buffer<Byte>::FromPointer((IntPtr)buffer), framesize);
+				frame->Time = time;
+				Audio->Data = frame->DataOption;
+			}
+			return true;
+		}
 	}
+	if (pool != nullptr && frame != nullptr)
+		frame->Return();
+	return false;
+}
 
-	// Find corresponding managed container
-	_Container^ container = nullptr;
-	for each(_Container^ it in _Containers->Values) {
-		if (it->Input == iformat) {
-			container = it;
-			break;
+/// <summary>
+/// Gets the vertical chroma subsampling factor of a planar pixel format, or 0 if the format is not known, in which case
+/// its chroma planes should not be given. This avoids av_pix_fmt_descriptors, as data exports can not be delay-loaded.
+/// </summary>
+int _ChromaSubsampling(PixelFormat Format) {
+	switch (Format) {
+	case PIX_FMT_YUV422P:
+	case PIX_FMT_YUVJ422P:
+	case PIX_FMT_YUV444P:
+	case PIX_FMT_YUVJ444P:
+	case PIX_FMT_YUV411P:
+	case PIX_FMT_YUV422P16LE:
+	case PIX_FMT_YUV422P16BE:
+	case PIX_FMT_YUV444P16LE:
+	case PIX_FMT_YUV444P16BE:
+	case PIX_FMT_YUV422P10LE:
+	case PIX_FMT_YUV422P10BE:
+		return 1;
+	case PIX_FMT_YUV420P:
+	case PIX_FMT_YUVJ420P:
+	case PIX_FMT_YUVA420P:
+	case PIX_FMT_YUV440P:
+	case PIX_FMT_YUVJ440P:
+	case PIX_FMT_NV12:
+	case PIX_FMT_NV21:
+	case PIX_FMT_YUV420P16LE:
+	case PIX_FMT_YUV420P16BE:
+	case PIX_FMT_YUV420P9LE:
+	case PIX_FMT_YUV420P9BE:
+	case PIX_FMT_YUV420P10LE:
+	case PIX_FMT_YUV420P10BE:
+		return 2;
+	case PIX_FMT_YUV410P:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+bool _Context::_DecodeVideo(VideoContent^ Video, int StreamIndex, AVPacket* Packet) {
+	AVStream* stream = this->_FormatContext->streams[StreamIndex];
+	AVCodecContext* codeccontext = stream->codec;
+	AVFrame* picture = this->_Picture;
+	avcodec_get_frame_defaults(picture);
+
+	// Video decoders consume whole packets.
+	int gotpicture = 0;
+	int64_t start = CounterNow();
+	int used = avcodec_decode_video2(codeccontext, picture, &gotpicture, Packet);
+	this->_CountDecode(start, used >= 0 && gotpicture);
+	Packet->size = 0;
+	if (used < 0 || !gotpicture)
+		return false;
+
+	// Describe the planes of the picture without copying them. Chroma planes of planar YUV formats may be subsampled
+	// vertically, and are left out for formats whose subsampling is not known. Pictures decoded in hardware are read back
+	// from their surface as NV12.
+	VideoFrame^ frame = Video->Frame;
+	HWAccel* hwaccel = this->_HWAccel[StreamIndex];
+	uint8_t* data[4] = { NULL, NULL, NULL, NULL };
+	int linesize[4] = { 0, 0, 0, 0 };
+	int rowsizes[4];
+	PixelFormat format = codeccontext->pix_fmt;
+	if (hwaccel != NULL && HWAccelActive(hwaccel)) {
+		if (!HWAccelRetrieve(hwaccel, picture, codeccontext->height, data, linesize))
+			return false;
+		format = PIX_FMT_NV12;
+		Video->Decoder = VideoDecoder::DXVA2;
+	} else {
+		for (int t = 0; t < 4; t++) {
+			data[t] = picture->data[t];
+			linesize[t] = picture->linesize[t];
 		}
+		Video->Decoder = VideoDecoder::Software;
+	}
+	if (av_image_fill_linesizes(rowsizes, format, codeccontext->width) < 0)
+		return false;
+	int subsampling = _ChromaSubsampling(format);
+	int planes = 0;
+	while (planes < 4 && data[planes] != NULL && rowsizes[planes] > 0) {
+		int height = codeccontext->height;
+		if (planes == 1 || planes == 2) {
+			if (subsampling == 0)
+				break;
+			height = (height + subsampling - 1) / subsampling;
+		}
+		MD::Buffer<Byte> buffer = MD::Buffer<Byte>::FromPointer((IntPtr)data[planes]);
+		frame->SetPlane(planes, VideoPlane(buffer, linesize[planes], rowsizes[planes], height));
+		planes++;
+	}
+	frame->SetPlaneCount(planes);
+	frame->Format = (VideoFormat)format;
+
+	// Use the presentation time of the packet the picture came from, if known.
+	if (picture->pkt_pts != AV_NOPTS_VALUE) {
+		int64_t timestamp = picture->pkt_pts;
+		if (stream->start_time != AV_NOPTS_VALUE)
+			timestamp -= stream->start_time;
+		frame->Time = timestamp * av_q2d(stream->time_base);
+	} else {
+		frame->Time = this->_StreamTime[StreamIndex];
 	}
+	Video->Data = frame->Option;
+	return true;
+}
+
+ReSampleContext* _Context::_GetResampler(int ContentIndex, AudioContent^ Audio) {
+	_ResampleState* state = &this->_Resample[ContentIndex];
+	int samplerate = (int)Audio->OutputSampleRate;
+	int channels = Audio->OutputChannels;
+	int format = (int)Audio->OutputFormat;
+	if (state->Context != NULL) {
+		if (state->SampleRate == samplerate && state->Channels == channels && state->Format == format)
+			return state->Context;
+		audio_resample_close(state->Context);
+		state->Context = NULL;
+	}
+
+	if (samplerate > 0 && channels > 0) {
+		state->Context = av_audio_resample_init(
+			channels, Audio->Channels, samplerate, (int)Audio->SampleRate,
+			(AVSampleFormat)format, (AVSampleFormat)Audio->Format,
+			16, 10, 0, 0.8);
+	}
+	if (state->Context == NULL) {
+		Audio->OutputSampleRate = Audio->SampleRate;
+		Audio->OutputChannels = Audio->Channels;
+		return NULL;
+	}
+	state->SampleRate = samplerate;
+	state->Channels = channels;
+	state->Format = format;
+	state->InputSamples = 0;
+	state->OutputSamples = 0;
+	return state->Context;
+}
+
+bool _Context::_DrainResampler(AudioContent^ Audio, int StreamIndex, bool Batch) {
+	int contentindex = this->_StreamContent[StreamIndex];
+	_ResampleState* state = &this->_Resample[contentindex];
+	if (state->Context == NULL)
+		return false;
 
-	return FSharpOption<Tuple<Container^, ExclusiveContext>^>::Some(Tuple::Create<Container^, ExclusiveContext>(container, _Context::Initialize(io, formatcontext)));
-}
\ No newline at end of file
+	// Push the held back samples out with silence longer than the filter, keeping only as many output samples as the
+	// input given to the resampler accounts for.
+	const int padding = 32;
+	int64_t expected = state->InputSamples * state->SampleRate / (int)Audio->SampleRate;
+	int remaining = (int)Math::Max(expected - state->OutputSamples, (int64_t)0);
+	int inputbps = AudioContent::BytesPerSample(Audio->Format);
+	memset(this->_Buffer, Audio->Format == AudioFormat::PCM8 ? 0x80 : 0, padding * Audio->Channels * inputbps);
+
+	int channels = state->Channels;
+	int outputbps = AudioContent::BytesPerSample(Audio->OutputFormat);
+	int outputsamples = (int)((int64_t)padding * state->SampleRate / (int)Audio->SampleRate) + 32;
+	int outputsize = outputsamples * channels * outputbps;
+	bool deinterleave = Audio->Planar && channels > 1;
+	AudioFramePool^ pool = Batch ? nullptr : Audio->Pool;
+	AudioFrame^ frame = nullptr;
+	Byte* output;
+	Byte* scratch = NULL;
+	if (Batch) {
+		output = (Byte*)Audio->Block->Reserve(outputsize).ToPointer();
+	} else if (pool != nullptr) {
+		frame = pool->Lease();
+		output = (Byte*)frame->Reserve(outputsize).ToPointer();
+	} else {
+		frame = Audio->Frame;
+		output = this->_ReserveOutput(outputsize * 2);
+		scratch = output + outputsize;
+	}
+	if (deinterleave && scratch == NULL)
+		scratch = this->_ReserveOutput(outputsize);
+	outputsamples = audio_resample(state->Context, (short*)(deinterleave ? scratch : output), (short*)this->_Buffer, padding);
+	outputsamples = Math::Min(outputsamples, remaining);
+	if (deinterleave && outputsamples > 0)
+		ConvertSamples(scratch, (int)Audio->OutputFormat, output, (int)Audio->OutputFormat, channels, outputsamples, true);
+	audio_resample_close(state->Context);
+	state->Context = NULL;
+
+	int framesize = outputsamples * channels * outputbps;
+	if (framesize <= 0) {
+		if (pool != nullptr)
+			frame->Return();
+		return false;
+	}
+	double time = this->_StreamTime[StreamIndex] - (double)outputsamples / state->SampleRate;
+	this->_CacheFrame(contentindex, Audio, output, framesize);
+	if (Batch) {
+		Audio->Block->Commit(framesize, time);
+	} else {
+		frame->Update(MD::Buffer<Byte>::FromPointer((IntPtr)output), framesize);
+		frame->Time = time;
+		Audio->Data = frame->DataOption;
+	}
+	return true;
+}
+
+void _Context::_ResetResamplers() {
+	for (int t = 0; t < this->Content->Length; t++) {
+		if (this->_Resample[t].Context != NULL) {
+			audio_resample_close(this->_Resample[t].Context);
+			this->_Resample[t].Context = NULL;
+		}
+	}
+}
+
+Byte* _Context::_ReserveOutput(int Size) {
+	if (Size > this->_OutputSize) {
+		av_free(this->_Output);
+		this->_Output = (Byte*)av_malloc(Size);
+		this->_OutputSize = Size;
+	}
+	return this->_Output;
+}
+
+bool _Context::Seek(int ContentIndex, double Time) {
+	if (ContentIndex < 0 || ContentIndex >= this->Content->Length)
+		return false;
+	this->_BeginCall();
+	bool seeked = this->_Seek(ContentIndex, Time);
+	this->_EndCall();
+	return seeked;
+}
+
+bool _Context::_Seek(int ContentIndex, double Time) {
+	int streamindex = this->_ContentStream[ContentIndex];
+	AVStream* stream = this->_FormatContext->streams[streamindex];
+	if (this->_SeekIndexed(streamindex, Time))
+		return true;
+
+	// Convert the time to the time base of the stream.
+	int64_t timestamp = (int64_t)(Time / av_q2d(stream->time_base));
+	if (stream->start_time != AV_NOPTS_VALUE)
+		timestamp += stream->start_time;
+
+	if (av_seek_frame(this->_FormatContext, streamindex, timestamp, AVSEEK_FLAG_BACKWARD) < 0)
+		return false;
+	this->_StopIndexing();
+	this->_StopCaching();
+	this->_StopSummarizing();
+	for (unsigned int t = 0; t < this->_FormatContext->nb_streams; t++)
+		this->_SkipSamples[t] = 0;
+
+	// Flush decoders for all content so no frames from before the seek are returned.
+	for (unsigned int t = 0; t < this->_FormatContext->nb_streams; t++) {
+		if (this->_StreamContent[t] != -1)
+			avcodec_flush_buffers(this->_FormatContext->streams[t]->codec);
+	}
+	this->_Pending->size = 0;
+	this->_EndOfStream = false;
+	this->_ResetResamplers();
+
+	// Use the requested time until a packet gives the actual time of a stream.
+	for (unsigned int t = 0; t < this->_FormatContext->nb_streams; t++)
+		this->_StreamTime[t] = Time;
+	return true;
+}
+
+bool _Context::_SeekIndexed(int StreamIndex, double Time) {
+	if (this->_SeekTables == nullptr || this->_SeekTables[StreamIndex] == nullptr)
+		return false;
+	SeekTable^ table = this->_SeekTables[StreamIndex];
+	int64_t target = Math::Max((int64_t)0, (int64_t)(Time * table->SampleRate));
+
+	// Start one entry early, so decoders that depend on previous packets have settled by the target sample. Seeking
+	// past the last entry scans forward from it, extending the table on the way.
+	int entry = Math::Max(table->Find(target) - 1, 0);
+	if (entry >= table->Count)
+		return false;
+	if (av_seek_frame(this->_FormatContext, StreamIndex, table->Position(entry), AVSEEK_FLAG_BYTE) < 0)
+		return false;
+
+	for (unsigned int t = 0; t < this->_FormatContext->nb_streams; t++) {
+		if (this->_StreamContent[t] != -1)
+			avcodec_flush_buffers(this->_FormatContext->streams[t]->codec);
+		this->_StreamTime[t] = Time;
+		this->_SkipSamples[t] = 0;
+		this->_Indexing[t] = false;
+	}
+	this->_Pending->size = 0;
+	this->_EndOfStream = false;
+	this->_ResetResamplers();
+	this->_StopCaching();
+	this->_StopSummarizing();
+
+	// Decode from the entry, discarding samples before the target.
+	this->_StreamSamples[StreamIndex] = table->Sample(entry);
+	this->_SkipSamples[StreamIndex] = target - table->Sample(entry);
+	this->_StreamTime[StreamIndex] = (double)table->Sample(entry) / table->SampleRate;
+	this->_Indexing[StreamIndex] = !this->Content[this->_StreamContent[StreamIndex]]->Ignore;
+	return true;
+}
+
+_ReadAheadContext::_ReadAheadContext(_Context^ Source, int Frames, double Time) : Context(_MirrorContent(Source->Content)) {
+	this->_Source = Source;
+	Source->CountConsume = false;
+	this->_Returned = 0;
+	this->_ConsumeTicks = 0;
+	this->_ConsumeEvents = 0;
+
+	// One slot is held by the reader and one is kept empty to distinguish a full ring from an empty one.
+	this->_SlotCount = Frames + 2;
+	this->_Slots = new _ReadAheadSlot[this->_SlotCount];
+	for (int t = 0; t < this->_SlotCount; t++) {
+		this->_Slots[t].Data = NULL;
+		this->_Slots[t].Size = 0;
+		this->_Slots[t].Capacity = 0;
+	}
+	this->_MaxTime = Time > 0.0 ? (int64_t)(Time * 1000000.0) : 0;
+	this->_Head = 0;
+	this->_Tail = 0;
+	this->_QueuedTime = 0;
+	this->_Holding = false;
+	this->_Finished = false;
+	this->_Stopping = false;
+	this->_Started = false;
+	this->_Direct = false;
+	this->_Disposed = false;
+	this->_SourceLock = gcnew Object();
+	this->_Produced = gcnew AutoResetEvent(false);
+	this->_Consumed = gcnew AutoResetEvent(false);
+
+	this->_Thread = gcnew Thread(gcnew ParameterizedThreadStart(&_ReadAheadContext::_Run));
+	this->_Thread->IsBackground = true;
+}
+
+_ReadAheadContext::~_ReadAheadContext() {
+	if (!this->_Disposed) {
+		this->_StopThread();
+		delete this->_Source;
+	}
+	this->!_ReadAheadContext();
+}
+
+_ReadAheadContext::!_ReadAheadContext() {
+	if (!this->_Disposed) {
+		this->_Disposed = true;
+
+		// When finalized, the decoding thread holds no reference to this context and is not using the slots. It stops once
+		// it finds the context collected, and the source context is finalized on its own.
+		this->_Stopping = true;
+		this->_Consumed->Set();
+		for (int t = 0; t < this->_SlotCount; t++)
+			av_free(this->_Slots[t].Data);
+		delete[] this->_Slots;
+	}
+}
+
+array<MD::Content^>^ _ReadAheadContext::_MirrorContent(array<MD::Content^>^ Content) {
+	array<MD::Content^>^ mirror = gcnew array<MD::Content^>(Content->Length);
+	for (int t = 0; t < Content->Length; t++) {
+		AudioContent^ audio = dynamic_cast<AudioContent^>(Content[t]);
+		VideoContent^ video = dynamic_cast<VideoContent^>(Content[t]);
+		if (audio != nullptr) {
+			AudioContent^ mirroraudio = gcnew AudioContent(audio->SampleRate, audio->Channels, audio->Format);
+			mirroraudio->SampleCount = audio->SampleCount;
+			mirroraudio->CacheSource = audio->CacheSource;
+			mirroraudio->Summary = audio->Summary;
+			mirror[t] = mirroraudio;
+		}
+		else if (video != nullptr)
+			mirror[t] = gcnew VideoContent(video->Width, video->Height, video->Format, video->FrameRate);
+		else
+			mirror[t] = gcnew MD::Content();
+		mirror[t]->Ignore = Content[t]->Ignore;
+		mirror[t]->Codec = Content[t]->Codec;
+	}
+	return mirror;
+}
+
+void _ReadAheadContext::_Run(Object^ State) {
+	Tuple<WeakReference^, AutoResetEvent^>^ state = (Tuple<WeakReference^, AutoResetEvent^>^)State;
+	bool wait;
+	while (_Step(state->Item1, wait)) {
+		if (wait)
+			state->Item2->WaitOne();
+	}
+}
+
+bool _ReadAheadContext::_Step(WeakReference^ Context, bool% Wait) {
+	_ReadAheadContext^ context = dynamic_cast<_ReadAheadContext^>(Context->Target);
+	if (context == nullptr || context->_Stopping)
+		return false;
+	Wait = context->_DecodeNext();
+	return true;
+}
+
+bool _ReadAheadContext::_DecodeNext() {
+	array<MD::Content^>^ sourcecontent = this->_Source->Content;
+
+	// Wait for the reader when far enough ahead, or when there is nothing left to decode.
+	int head = this->_Head;
+	int next = (head + 1) % this->_SlotCount;
+	bool full = next == this->_Tail;
+	bool ahead = this->_MaxTime > 0 && Interlocked::Read(this->_QueuedTime) >= this->_MaxTime;
+	if (full || ahead || this->_Finished)
+		return true;
+
+	Monitor::Enter(this->_SourceLock);
+	try {
+		if (this->_Head != head)
+			return false;
+		this->_SyncSource();
+
+		int contentindex;
+		if (this->_Source->NextFrame(contentindex)) {
+			_ReadAheadSlot* slot = &this->_Slots[head];
+			slot->ContentIndex = contentindex;
+			slot->Size = -1;
+			slot->Time = 0.0;
+			slot->Duration = 0;
+
+			// Copy the frame into the slot.
+			AudioContent^ audio = dynamic_cast<AudioContent^>(sourcecontent[contentindex]);
+			if (audio != nullptr && !audio->Ignore && audio->Data != nullptr) {
+				AudioFrame^ frame = (AudioFrame^)audio->Data->Value;
+				int size = frame->NativeSize;
+				if (size > slot->Capacity) {
+					slot->Data = (Byte*)av_realloc(slot->Data, size);
+					slot->Capacity = size;
+				}
+				memcpy(slot->Data, frame->Buffer.Start.ToPointer(), size);
+				slot->Size = size;
+				slot->Time = frame->Time;
+				int samplesize = audio->OutputChannels * AudioContent::BytesPerSample(audio->OutputFormat);
+				if (samplesize > 0)
+					slot->Duration = (int64_t)((size / samplesize) * 1000000.0 / audio->OutputSampleRate);
+			}
+
+			// Publish the slot to the reader.
+			Interlocked::Add(this->_QueuedTime, slot->Duration);
+			this->_Head = next;
+		} else {
+			this->_Finished = true;
+		}
+	} finally {
+		Monitor::Exit(this->_SourceLock);
+	}
+	this->_Produced->Set();
+	return false;
+}
+
+void _ReadAheadContext::_ReleaseSlot() {
+	if (this->_Holding) {
+		this->_Holding = false;
+		int tail = this->_Tail;
+		Interlocked::Add(this->_QueuedTime, -this->_Slots[tail].Duration);
+		this->_Tail = (tail + 1) % this->_SlotCount;
+		this->_Consumed->Set();
+	}
+}
+
+bool _ReadAheadContext::_NextSlot() {
+	this->_ReleaseSlot();
+
+	// Wait for the decoder only if no frame is ready.
+	while (this->_Tail == this->_Head) {
+		if ((this->_Finished || this->_Direct) && this->_Tail == this->_Head)
+			return false;
+		this->_Produced->WaitOne();
+	}
+	return true;
+}
+
+bool _ReadAheadContext::_Bypass() {
+	this->_ReleaseSlot();
+	if (!this->_Direct) {
+		array<MD::Content^>^ content = this->Content;
+		bool video = false;
+		for (int t = 0; t < content->Length; t++) {
+			if (dynamic_cast<VideoContent^>(content[t]) != nullptr && !content[t]->Ignore)
+				video = true;
+		}
+		if (video) {
+			this->_StopThread();
+		} else if (!this->_Started) {
+			this->_Started = true;
+			this->_Thread->Start(Tuple::Create(gcnew WeakReference(this), this->_Consumed));
+		}
+	}
+
+	// Frames decoded before the thread was stopped are still read in order.
+	return this->_Direct && this->_Tail == this->_Head;
+}
+
+void _ReadAheadContext::_StopThread() {
+	if (!this->_Direct) {
+		this->_Direct = true;
+		this->_Stopping = true;
+		this->_Consumed->Set();
+		if (this->_Started)
+			this->_Thread->Join();
+	}
+}
+
+void _ReadAheadContext::_SyncSource() {
+	array<MD::Content^>^ content = this->Content;
+	array<MD::Content^>^ sourcecontent = this->_Source->Content;
+	for (int t = 0; t < content->Length; t++) {
+		sourcecontent[t]->Ignore = content[t]->Ignore;
+		AudioContent^ audio = dynamic_cast<AudioContent^>(content[t]);
+		if (audio != nullptr) {
+			AudioContent^ sourceaudio = (AudioContent^)sourcecontent[t];
+			sourceaudio->OutputFormat = audio->OutputFormat;
+			sourceaudio->Planar = audio->Planar;
+			sourceaudio->OutputSampleRate = audio->OutputSampleRate;
+			sourceaudio->OutputChannels = audio->OutputChannels;
+		}
+	}
+}
+
+bool _ReadAheadContext::_ReadDirect(int% ContentIndex) {
+	this->_SyncSource();
+	int contentindex;
+	bool read;
+	Monitor::Enter(this->_SourceLock);
+	try {
+		read = this->_Source->NextFrame(contentindex);
+	} finally {
+		Monitor::Exit(this->_SourceLock);
+	}
+	if (!read)
+		return false;
+	ContentIndex = contentindex;
+	MD::Content^ source = this->_Source->Content[contentindex];
+	AudioContent^ audio = dynamic_cast<AudioContent^>(this->Content[contentindex]);
+	VideoContent^ video = dynamic_cast<VideoContent^>(this->Content[contentindex]);
+	if (audio != nullptr && !audio->Ignore) {
+		AudioContent^ sourceaudio = (AudioContent^)source;
+		if (sourceaudio->Data != nullptr) {
+			AudioFrame^ frame = (AudioFrame^)sourceaudio->Data->Value;
+			this->_Deliver(audio, (Byte*)frame->Buffer.Start.ToPointer(), frame->NativeSize, frame->Time);
+		}
+	} else if (video != nullptr && !video->Ignore) {
+		VideoContent^ sourcevideo = (VideoContent^)source;
+		video->Decoder = sourcevideo->Decoder;
+		video->Data = sourcevideo->Data;
+	}
+	return true;
+}
+
+bool _ReadAheadContext::_Deliver(AudioContent^ Audio, Byte* Data, int Size, double Time) {
+	AudioFramePool^ pool = Audio->Pool;
+	if (pool != nullptr) {
+		AudioFrame^ frame = pool->Lease();
+		Byte* buffer = (Byte*)frame->Reserve(Size).ToPointer();
+		memcpy(buffer, Data, Size);
+		frame->Update(MD::Buffer<Byte>::FromPointer((IntPtr)buffer), Size);
+		frame->Time = Time;
+		Audio->Data = frame->DataOption;
+		return true;
+	}
+
+	AudioFrame^ frame = Audio->Frame;
+	frame->Update(MD::Buffer<Byte>::FromPointer((IntPtr)Data), Size);
+	frame->Time = Time;
+	Audio->Data = frame->DataOption;
+	return false;
+}
+
+bool _ReadAheadContext::NextFrame(int% ContentIndex) {
+	this->_BeginCall();
+	bool result = this->_ReadFrame(ContentIndex);
+	this->_EndCall();
+	return result;
+}
+
+bool _ReadAheadContext::_ReadFrame(int% ContentIndex) {
+	if (this->_Bypass())
+		return this->_ReadDirect(ContentIndex);
+	if (!this->_NextSlot())
+		return this->_Direct && this->_ReadDirect(ContentIndex);
+
+	// Frames copied into a leased frame allow the slot to be reused immediately.
+	_ReadAheadSlot* slot = &this->_Slots[this->_Tail];
+	ContentIndex = slot->ContentIndex;
+	this->_Holding = true;
+	AudioContent^ audio = dynamic_cast<AudioContent^>(this->Content[slot->ContentIndex]);
+	if (audio != nullptr && slot->Size >= 0 && this->_Deliver(audio, slot->Data, slot->Size, slot->Time))
+		this->_ReleaseSlot();
+	return true;
+}
+
+int _ReadAheadContext::NextFrames(int MaxFrames, int MaxBytes) {
+	array<MD::Content^>^ content = this->Content;
+	_CheckBatch(content);
+	this->_BeginCall();
+	for (int t = 0; t < content->Length; t++) {
+		AudioContent^ audio = dynamic_cast<AudioContent^>(content[t]);
+		if (audio != nullptr)
+			audio->Block->Clear();
+	}
+
+	// Copy decoded slots straight into the blocks for each content, releasing each slot as soon as it is copied. Once
+	// the thread is stopped, frames are read from the source after the remaining slots.
+	bool direct = this->_Bypass();
+	int frames = 0;
+	int bytes = 0;
+	while (!direct && frames < MaxFrames && bytes < MaxBytes && this->_NextSlot()) {
+		_ReadAheadSlot* slot = &this->_Slots[this->_Tail];
+		this->_Holding = true;
+		AudioContent^ audio = dynamic_cast<AudioContent^>(content[slot->ContentIndex]);
+		if (audio != nullptr && !audio->Ignore && slot->Size >= 0) {
+			AudioBlock^ block = audio->Block;
+			memcpy(block->Reserve(slot->Size).ToPointer(), slot->Data, slot->Size);
+			block->Commit(slot->Size, slot->Time);
+			bytes += slot->Size;
+			frames++;
+		}
+	}
+	this->_ReleaseSlot();
+	while (this->_Direct && frames < MaxFrames && bytes < MaxBytes) {
+		this->_SyncSource();
+		int contentindex;
+		bool read;
+		Monitor::Enter(this->_SourceLock);
+		try {
+			read = this->_Source->NextFrame(contentindex);
+		} finally {
+			Monitor::Exit(this->_SourceLock);
+		}
+		if (!read)
+			break;
+		AudioContent^ audio = dynamic_cast<AudioContent^>(content[contentindex]);
+		AudioContent^ sourceaudio = dynamic_cast<AudioContent^>(this->_Source->Content[contentindex]);
+		if (audio != nullptr && !audio->Ignore && sourceaudio->Data != nullptr) {
+			AudioFrame^ frame = (AudioFrame^)sourceaudio->Data->Value;
+			AudioBlock^ block = audio->Block;
+			memcpy(block->Reserve(frame->NativeSize).ToPointer(), frame->Buffer.Start.ToPointer(), frame->NativeSize);
+			block->Commit(frame->NativeSize, frame->Time);
+			bytes += frame->NativeSize;
+			frames++;
+		}
+	}
+
+	for (int t = 0; t < content->Length; t++) {
+		AudioContent^ audio = dynamic_cast<AudioContent^>(content[t]);
+		if (audio != nullptr && audio->Block->Frames > 0)
+			audio->Data = audio->Block->DataOption;
+	}
+	this->_EndCall();
+	return frames;
+}
+
+bool _ReadAheadContext::NextPacket(ContentPacket^ Packet) {
+
+	// Packets are read where the decoder would be, so the thread must not have read any. Reading packets and frames is
+	// not mixed, so the thread is only ever started by a frame read.
+	this->_BeginCall();
+	this->_StopThread();
+	this->_SyncSource();
+	bool result;
+	Monitor::Enter(this->_SourceLock);
+	try {
+		result = this->_Source->NextPacket(Packet);
+	} finally {
+		Monitor::Exit(this->_SourceLock);
+	}
+	this->_EndCall();
+	return result;
+}
+
+bool _ReadAheadContext::Seek(int ContentIndex, double Time) {
+	if (ContentIndex < 0 || ContentIndex >= this->Content->Length)
+		return false;
+	this->_BeginCall();
+	bool result;
+	Monitor::Enter(this->_SourceLock);
+	try {
+		result = this->_Source->Seek(ContentIndex, Time);
+
+		// Discard frames decoded before the seek. The decoder is not writing while the lock is held.
+		this->_Holding = false;
+		this->_Tail = this->_Head;
+		Interlocked::Exchange(this->_QueuedTime, 0);
+		this->_Finished = false;
+	} finally {
+		Monitor::Exit(this->_SourceLock);
+	}
+	this->_Consumed->Set();
+	this->_EndCall();
+	return result;
+}
+
+ContextStats^ _ReadAheadContext::Stats::get() {
+
+	// The source only runs with the lock held, so its counters are not read while the decoding thread updates them.
+	ContextStats^ source;
+	Monitor::Enter(this->_SourceLock);
+	try {
+		source = this->_Source->Stats;
+	} finally {
+		Monitor::Exit(this->_SourceLock);
+	}
+	return gcnew ContextStats(source->BytesRead, source->Reads, source->PacketsDemuxed, source->PacketsDiscarded,
+		source->FramesDecoded, source->ReadTime, source->DemuxTime, source->DecodeTime,
+		this->_ConsumeTicks / (double)CounterFrequency());
+}
+
+void _ReadAheadContext::_BeginCall() {
+	if (this->_Returned == 0)
+		return;
+	int64_t duration = CounterNow() - this->_Returned;
+	this->_ConsumeTicks += duration;
+	ContextTraceAction^ trace = this->Trace;
+	if (trace != nullptr && ++this->_ConsumeEvents % this->TraceInterval == 0)
+		trace->Invoke(ContextPhase::Consume, this->_Returned, duration);
+}
+
+void _ReadAheadContext::_EndCall() {
+	this->_Returned = CounterNow();
+}
+
+FSharpOption<ExclusiveContext>^ _Container::Decode(ExclusiveByteStream Stream, DecodeParameters^ Parameters) {
+	if (this->Input == NULL)
+		return FSharpOption<ExclusiveContext>::None;
+
+	AVIOContext* io = InitStreamContext(Stream);
+		
+	// Find stream format information
+	AVFormatContext* formatcontext = OpenInput(io, this->Input, nullptr, nullptr, Parameters);
+	if (formatcontext == NULL)
+	{
+		CloseStreamContext(io);
+		return FSharpOption<ExclusiveContext>::None;
+	}
+
+	return FSharpOption<ExclusiveContext>::Some(_Context::Initialize(io, formatcontext, Parameters, nullptr));
+}
+
+FSharpOption<ExclusiveByteStream>^ _Container::Encode(ExclusiveContext Context) {
+	_EncodeStream^ stream = _EncodeStream::Create(this->Output, Context);
+	if (stream == nullptr)
+		return FSharpOption<ExclusiveByteStream>::None;
+	return FSharpOption<ExclusiveByteStream>::Some(Exclusive::dispose<ByteStream^>(stream));
+}
+
+FSharpOption<ExclusiveByteStream>^ _Container::Remux(ExclusiveContext Context) {
+	_RemuxStream^ stream = _RemuxStream::Create(this->Output, Context);
+	if (stream == nullptr)
+		return FSharpOption<ExclusiveByteStream>::None;
+	return FSharpOption<ExclusiveByteStream>::Some(Exclusive::dispose<ByteStream^>(stream));
+}
+
+/// <summary>
+/// Chooses the output sample format of audio content for an encoder, preferring the current output format. Returns
+/// false if the encoder accepts none of the formats the content can be converted to.
+/// </summary>
+bool _SelectSampleFormat(AVCodec* Codec, AudioContent^ Audio) {
+	if (Codec->sample_fmts == NULL)
+		return true;
+	array<AudioFormat>^ candidates = { Audio->OutputFormat, Audio->Format, AudioFormat::Float, AudioFormat::Double };
+	for each (AudioFormat candidate in candidates) {
+		for (const AVSampleFormat* format = Codec->sample_fmts; *format != AV_SAMPLE_FMT_NONE; format++) {
+			if (*format == (AVSampleFormat)candidate) {
+				Audio->OutputFormat = candidate;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+_OutputStream::_OutputStream(AVOutputFormat* Format, ExclusiveContext Context) : ByteStream(1) {
+	this->_Context = Context;
+	this->_FormatContext = avformat_alloc_context();
+	this->_FormatContext->oformat = Format;
+	this->_IOContext = NULL;
+	this->_Output = gcnew array<Byte>(StreamBufferSize);
+	this->_OutputStart = 0;
+	this->_OutputEnd = 0;
+	this->_Finished = false;
+	this->_Disposed = false;
+}
+
+_OutputStream::~_OutputStream() {
+	this->!_OutputStream();
+}
+
+_OutputStream::!_OutputStream() {
+	if (!this->_Disposed) {
+		this->_Disposed = true;
+		if (this->_FormatContext != NULL)
+			avformat_free_context(this->_FormatContext);
+		if (this->_IOContext != NULL) {
+			delete (gcroot<_OutputStream^>*)this->_IOContext->opaque;
+			av_free(this->_IOContext->buffer);
+			av_free(this->_IOContext);
+		}
+		this->_Context.Release->Invoke();
+	}
+}
+
+bool _OutputStream::_Begin() {
+
+	// Write into the stream as output is produced. The output can not be seeked back into.
+	uint8_t* buffer = (uint8_t*)av_malloc(StreamBufferSize);
+	gcroot<_OutputStream^>* opaque = new gcroot<_OutputStream^>(this);
+	this->_IOContext = avio_alloc_context(buffer, StreamBufferSize, 1, opaque, NULL, &write_packet, NULL);
+	this->_IOContext->seekable = 0;
+	this->_FormatContext->pb = this->_IOContext;
+	return av_write_header(this->_FormatContext) >= 0;
+}
+
+void _OutputStream::_End() {
+	av_write_trailer(this->_FormatContext);
+	avio_flush(this->_IOContext);
+	this->_Finished = true;
+}
+
+int _OutputStream::Read(array<Byte>^ Target, int Offset, int Size) {
+	int read = 0;
+	while (read < Size) {
+		if (this->_OutputStart == this->_OutputEnd) {
+			if (this->_Finished)
+				break;
+			this->_Step();
+			continue;
+		}
+		int count = Math::Min(Size - read, this->_OutputEnd - this->_OutputStart);
+		Array::Copy(this->_Output, this->_OutputStart, Target, Offset + read, count);
+		this->_OutputStart += count;
+		read += count;
+	}
+	return read;
+}
+
+void _OutputStream::Write(uint8_t* Data, int Size) {
+	using namespace Runtime::InteropServices;
+
+	if (this->_OutputStart == this->_OutputEnd) {
+		this->_OutputStart = 0;
+		this->_OutputEnd = 0;
+	}
+
+	// Move pending output to the start of the buffer, growing it if needed.
+	if (this->_OutputEnd + Size > this->_Output->Length) {
+		int pending = this->_OutputEnd - this->_OutputStart;
+		array<Byte>^ output = this->_Output;
+		if (pending + Size > output->Length)
+			output = gcnew array<Byte>(Math::Max(output->Length * 2, pending + Size));
+		Array::Copy(this->_Output, this->_OutputStart, output, 0, pending);
+		this->_Output = output;
+		this->_OutputStart = 0;
+		this->_OutputEnd = pending;
+	}
+	Marshal::Copy(IntPtr(Data), this->_Output, this->_OutputEnd, Size);
+	this->_OutputEnd += Size;
+}
+
+_EncodeStream::_EncodeStream(AVOutputFormat* Format, ExclusiveContext Context) : _OutputStream(Format, Context) {
+	this->_States = NULL;
+	this->_StateCount = 0;
+	this->_ContentState = NULL;
+	this->_Samples = NULL;
+	this->_Packet = NULL;
+	this->_PacketSize = 0;
+	this->_Transfer = nullptr;
+}
+
+_EncodeStream^ _EncodeStream::Create(AVOutputFormat* Format, ExclusiveContext Context) {
+	AVCodec* codec = NULL;
+	if (Format != NULL && Format->audio_codec != CODEC_ID_NONE)
+		codec = avcodec_find_encoder(Format->audio_codec);
+	if (codec == NULL) {
+		Context.Release->Invoke();
+		return nullptr;
+	}
+
+	// The stream takes ownership of the context, releasing it if creation fails.
+	_EncodeStream^ stream = gcnew _EncodeStream(Format, Context);
+	array<MD::Content^>^ content = Context.Object->Content;
+	AVFormatContext* formatcontext = stream->_FormatContext;
+	stream->_ContentState = new int[content->Length];
+	stream->_States = new _EncodeState[content->Length];
+
+	// Add an output stream for each audio content, choosing output settings the encoder accepts.
+	int maxframesize = 0;
+	for (int t = 0; t < content->Length; t++) {
+		stream->_ContentState[t] = -1;
+		AudioContent^ audio = dynamic_cast<AudioContent^>(content[t]);
+		if (audio == nullptr || !_SelectSampleFormat(codec, audio)) {
+			content[t]->Ignore = true;
+			continue;
+		}
+		if (codec->supported_samplerates != NULL) {
+			int samplerate = (int)audio->OutputSampleRate;
+			int best = 0;
+			for (const int* rate = codec->supported_samplerates; *rate != 0; rate++) {
+				if (best == 0 || Math::Abs(*rate - samplerate) < Math::Abs(best - samplerate))
+					best = *rate;
+			}
+			audio->OutputSampleRate = best;
+		}
+		audio->Planar = false;
+
+		AVStream* output = av_new_stream(formatcontext, stream->_StateCount);
+		AVCodecContext* codeccontext = output->codec;
+		codeccontext->codec_type = AVMEDIA_TYPE_AUDIO;
+		codeccontext->codec_id = codec->id;
+		codeccontext->sample_fmt = (AVSampleFormat)audio->OutputFormat;
+		codeccontext->sample_rate = (int)audio->OutputSampleRate;
+		codeccontext->channels = audio->OutputChannels;
+		codeccontext->time_base.num = 1;
+		codeccontext->time_base.den = codeccontext->sample_rate;
+		if (Format->flags & AVFMT_GLOBALHEADER)
+			codeccontext->flags |= CODEC_FLAG_GLOBAL_HEADER;
+		if (avcodec_open(codeccontext, codec) < 0) {
+			delete stream;
+			return nullptr;
+		}
+
+		// Encoders without a fixed frame size take any amount of samples.
+		_EncodeState* state = &stream->_States[stream->_StateCount];
+		state->Stream = output;
+		state->Fifo = av_fifo_alloc(0);
+		state->FrameSize = codeccontext->frame_size > 1 ? codeccontext->frame_size : 1024;
+		state->SampleSize = audio->OutputChannels * AudioContent::BytesPerSample(audio->OutputFormat);
+		state->Samples = 0;
+		maxframesize = Math::Max(maxframesize, state->FrameSize * state->SampleSize);
+		stream->_ContentState[t] = stream->_StateCount++;
+	}
+	if (stream->_StateCount == 0) {
+		delete stream;
+		return nullptr;
+	}
+	stream->_Samples = (uint8_t*)av_malloc(maxframesize);
+	stream->_PacketSize = Math::Max(FF_MIN_BUFFER_SIZE, maxframesize * 2);
+	stream->_Packet = (uint8_t*)av_malloc(stream->_PacketSize);
+
+	if (!stream->_Begin()) {
+		delete stream;
+		return nullptr;
+	}
+	return stream;
+}
+
+_EncodeStream::~_EncodeStream() {
+	this->!_EncodeStream();
+}
+
+_EncodeStream::!_EncodeStream() {
+
+	// Codecs are closed before the base stream frees the format context that holds them.
+	for (int t = 0; t < this->_StateCount; t++) {
+		avcodec_close(this->_States[t].Stream->codec);
+		av_fifo_free(this->_States[t].Fifo);
+	}
+	this->_StateCount = 0;
+	delete[] this->_States;
+	delete[] this->_ContentState;
+	av_free(this->_Samples);
+	av_free(this->_Packet);
+	this->_States = NULL;
+	this->_ContentState = NULL;
+	this->_Samples = NULL;
+	this->_Packet = NULL;
+}
+
+void _EncodeStream::_Step() {
+	Context^ context = this->_Context.Object;
+	int contentindex;
+	if (context->NextFrame(contentindex)) {
+		int stateindex = this->_ContentState[contentindex];
+		AudioContent^ audio = dynamic_cast<AudioContent^>(context->Content[contentindex]);
+		if (stateindex >= 0 && audio->Data != nullptr) {
+			_EncodeState* state = &this->_States[stateindex];
+			AVCodecContext* codeccontext = state->Stream->codec;
+
+			// Stop encoding content whose output settings could not be applied by the context.
+			if ((int)audio->OutputSampleRate != codeccontext->sample_rate || audio->OutputChannels != codeccontext->channels ||
+				(int)audio->OutputFormat != (int)codeccontext->sample_fmt || audio->Planar) {
+				audio->Ignore = true;
+				return;
+			}
+
+			ByteData^ data = audio->Data->Value;
+			AudioFrame^ frame = dynamic_cast<AudioFrame^>(data);
+			if (frame != nullptr) {
+				av_fifo_generic_write(state->Fifo, frame->Buffer.Start.ToPointer(), frame->NativeSize, NULL);
+				frame->Return();
+			} else {
+				int size = (int)data->Size;
+				if (size > 0) {
+					if (this->_Transfer == nullptr || this->_Transfer->Length < size)
+						this->_Transfer = gcnew array<Byte>(size);
+					data->Read(0, this->_Transfer, 0, size);
+					pin_ptr<Byte> transfer = &this->_Transfer[0];
+					av_fifo_generic_write(state->Fifo, transfer, size, NULL);
+				}
+			}
+			this->_Encode(state, false);
+		}
+		return;
+	}
+
+	// Encode the remaining samples and finish the output.
+	for (int t = 0; t < this->_StateCount; t++)
+		this->_Encode(&this->_States[t], true);
+	this->_End();
+}
+
+void _EncodeStream::_Encode(_EncodeState* State, bool Flush) {
+	AVCodecContext* codeccontext = State->Stream->codec;
+	bool fixedframes = codeccontext->frame_size > 1;
+	int framebytes = State->FrameSize * State->SampleSize;
+	while (true) {
+		int available = av_fifo_size(State->Fifo);
+		int size;
+		if (available >= framebytes)
+			size = framebytes;
+		else if (Flush && available > 0)
+			size = available;
+		else
+			break;
+		av_fifo_generic_read(State->Fifo, this->_Samples, size, NULL);
+
+		// Encoders with a fixed frame size get a full frame, padded with silence. PCM encoders take the amount of samples
+		// from the output size, so they get the size that fits the given samples, and the others get the whole packet
+		// buffer, which holds twice the largest input frame.
+		int outputsize = this->_PacketSize;
+		int bits = av_get_bits_per_sample(codeccontext->codec_id);
+		if (fixedframes) {
+			if (size < framebytes)
+				memset(this->_Samples + size, 0, framebytes - size);
+		} else if (bits > 0) {
+			outputsize = (size / State->SampleSize) * codeccontext->channels * (bits / 8);
+		}
+		int encoded = avcodec_encode_audio(codeccontext, this->_Packet, outputsize, (const short*)this->_Samples);
+		this->_WritePacket(State, encoded);
+		State->Samples += size / State->SampleSize;
+	}
+
+	// Drain frames delayed by the encoder.
+	if (Flush && (codeccontext->codec->capabilities & CODEC_CAP_DELAY)) {
+		int encoded;
+		while ((encoded = avcodec_encode_audio(codeccontext, this->_Packet, this->_PacketSize, NULL)) > 0)
+			this->_WritePacket(State, encoded);
+	}
+}
+
+void _EncodeStream::_WritePacket(_EncodeState* State, int Size) {
+	if (Size <= 0)
+		return;
+	AVCodecContext* codeccontext = State->Stream->codec;
+	AVPacket packet;
+	av_init_packet(&packet);
+	packet.stream_index = State->Stream->index;
+	packet.data = this->_Packet;
+	packet.size = Size;
+	packet.flags |= AV_PKT_FLAG_KEY;
+	AVFrame* coded = codeccontext->coded_frame;
+	int64_t pts = coded != NULL && coded->pts != AV_NOPTS_VALUE ? coded->pts : State->Samples;
+	packet.pts = av_rescale_q(pts, codeccontext->time_base, State->Stream->time_base);
+	packet.dts = packet.pts;
+	av_interleaved_write_frame(this->_FormatContext, &packet);
+}
+
+_RemuxStream::_RemuxStream(AVOutputFormat* Format, ExclusiveContext Context) : _OutputStream(Format, Context) {
+	this->_ContentStream = NULL;
+	this->_Packet = gcnew ContentPacket();
+}
+
+_RemuxStream^ _RemuxStream::Create(AVOutputFormat* Format, ExclusiveContext Context) {
+	if (Format == NULL) {
+		Context.Release->Invoke();
+		return nullptr;
+	}
+
+	// The stream takes ownership of the context, releasing it if creation fails.
+	_RemuxStream^ stream = gcnew _RemuxStream(Format, Context);
+	array<MD::Content^>^ content = Context.Object->Content;
+	AVFormatContext* formatcontext = stream->_FormatContext;
+	stream->_ContentStream = new int[content->Length];
+
+	// Add an output stream for each audio and video content read by FFmpeg, copying the parameters of the source stream.
+	// The muxer rejects the header if it can not store one of the codecs.
+	for (int t = 0; t < content->Length; t++) {
+		stream->_ContentStream[t] = -1;
+		_Codec^ codec = dynamic_cast<_Codec^>(content[t]->Codec);
+		AVMediaType type = codec != nullptr ? codec->Stream->codec->codec_type : AVMEDIA_TYPE_UNKNOWN;
+		if (type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_VIDEO) {
+			content[t]->Ignore = true;
+			continue;
+		}
+
+		AVStream* source = codec->Stream;
+		AVStream* output = av_new_stream(formatcontext, formatcontext->nb_streams);
+		AVCodecContext* codeccontext = output->codec;
+		if (avcodec_copy_context(codeccontext, source->codec) < 0) {
+			delete stream;
+			return nullptr;
+		}
+
+		// Let the muxer choose the tag for the codec, and keep the timing of the source stream.
+		codeccontext->codec_tag = 0;
+		codeccontext->time_base = source->time_base;
+		output->r_frame_rate = source->r_frame_rate;
+		output->sample_aspect_ratio = source->sample_aspect_ratio;
+		if (Format->flags & AVFMT_GLOBALHEADER)
+			codeccontext->flags |= CODEC_FLAG_GLOBAL_HEADER;
+		content[t]->Ignore = false;
+		stream->_ContentStream[t] = output->index;
+	}
+	if (formatcontext->nb_streams == 0 || !stream->_Begin()) {
+		delete stream;
+		return nullptr;
+	}
+	return stream;
+}
+
+_RemuxStream::~_RemuxStream() {
+	this->!_RemuxStream();
+}
+
+_RemuxStream::!_RemuxStream() {
+	delete[] this->_ContentStream;
+	this->_ContentStream = NULL;
+}
+
+void _RemuxStream::_Step() {
+	ContentPacket^ packet = this->_Packet;
+	if (!this->_Context.Object->NextPacket(packet)) {
+		this->_End();
+		return;
+	}
+	int streamindex = this->_ContentStream[packet->ContentIndex];
+	if (streamindex < 0)
+		return;
+
+	// Rescale timestamps from the time base of the packet to that of the output stream.
+	AVStream* output = this->_FormatContext->streams[streamindex];
+	AVRational timebase = { packet->TimeBaseNumerator, packet->TimeBaseDenominator };
+	AVPacket outputpacket;
+	av_init_packet(&outputpacket);
+	outputpacket.stream_index = streamindex;
+	outputpacket.data = (uint8_t*)packet->Buffer.Start.ToPointer();
+	outputpacket.size = packet->NativeSize;
+	if (packet->Key)
+		outputpacket.flags |= AV_PKT_FLAG_KEY;
+	outputpacket.pts = packet->Timestamp != AV_NOPTS_VALUE ? av_rescale_q(packet->Timestamp, timebase, output->time_base) : AV_NOPTS_VALUE;
+	outputpacket.dts = packet->DecodeTimestamp != AV_NOPTS_VALUE ? av_rescale_q(packet->DecodeTimestamp, timebase, output->time_base) : AV_NOPTS_VALUE;
+	outputpacket.duration = (int)av_rescale_q(packet->Duration, timebase, output->time_base);
+	av_interleaved_write_frame(this->_FormatContext, &outputpacket);
+}
+
+int write_packet(void* opaque, uint8_t* buf, int buf_size) {
+	_OutputStream^ stream = *(gcroot<_OutputStream^>*)opaque;
+	stream->Write(buf, buf_size);
+	return buf_size;
+}
+
+AVInputFormat* _FindInput(const char* Name) {
+	AVInputFormat* iformat = av_iformat_next(NULL);
+	while (iformat != NULL && strcmp(iformat->name, Name) != 0)
+		iformat = av_iformat_next(iformat);
+	return iformat;
+}
+
+AVOutputFormat* _FindOutput(const char* Name) {
+	AVOutputFormat* oformat = av_oformat_next(NULL);
+	while (oformat != NULL && strcmp(oformat->name, Name) != 0)
+		oformat = av_oformat_next(oformat);
+	return oformat;
+}
+
+/// <summary>
+/// Describes the codec parameters of the streams in a format context for a probe cache, along with the timing that
+/// av_find_stream_info would otherwise recover from the stream data.
+/// </summary>
+String^ _DescribeStreams(AVFormatContext* Context) {
+	using namespace Runtime::InteropServices;
+
+	StringBuilder^ result = gcnew StringBuilder(gcnew String(Context->iformat->name));
+	result->AppendFormat("|{0},{1}|", (Int64)Context->start_time, (Int64)Context->duration);
+	for (unsigned int i = 0; i < Context->nb_streams; i++) {
+		AVStream* stream = Context->streams[i];
+		AVCodecContext* codec = stream->codec;
+		result->AppendFormat("{0},{1},{2},{3},{4},{5},{6},{7},{8},",
+			(int)codec->codec_id, (int)codec->codec_type, codec->sample_rate, codec->channels, (int)codec->sample_fmt,
+			codec->bit_rate, codec->block_align, codec->frame_size, (Int64)codec->channel_layout);
+		result->AppendFormat("{0},{1},{2},", codec->width, codec->height, (int)codec->pix_fmt);
+		result->AppendFormat("{0},{1},{2},{3},{4},{5},",
+			stream->time_base.num, stream->time_base.den, stream->r_frame_rate.num, stream->r_frame_rate.den,
+			(Int64)stream->start_time, (Int64)stream->duration);
+		array<Byte>^ extradata = gcnew array<Byte>(codec->extradata != NULL ? codec->extradata_size : 0);
+		if (extradata->Length > 0)
+			Marshal::Copy(IntPtr(codec->extradata), extradata, 0, extradata->Length);
+		result->Append(Convert::ToBase64String(extradata));
+		result->Append(';');
+	}
+	return result->ToString();
+}
+
+/// <summary>
+/// Restores the stream parameters described by a probe cache to a format context. Returns false, without modifying
+/// the context, if the description is malformed or does not match the streams in the context.
+/// </summary>
+bool _RestoreStreams(AVFormatContext* Context, String^ Timing, array<String^>^ Streams) {
+	using namespace Runtime::InteropServices;
+
+	const int fieldcount = 19;
+	array<String^>^ timingfields = Timing->Split(',');
+	Int64 starttime, duration;
+	if (timingfields->Length != 2 || !Int64::TryParse(timingfields[0], starttime) || !Int64::TryParse(timingfields[1], duration))
+		return false;
+	if (Streams->Length != (int)Context->nb_streams)
+		return false;
+	array<array<Int64>^>^ values = gcnew array<array<Int64>^>(Streams->Length);
+	array<array<Byte>^>^ extradata = gcnew array<array<Byte>^>(Streams->Length);
+	for (int i = 0; i < Streams->Length; i++) {
+		array<String^>^ fields = Streams[i]->Split(',');
+		if (fields->Length != fieldcount)
+			return false;
+		values[i] = gcnew array<Int64>(fieldcount - 1);
+		for (int j = 0; j < fieldcount - 1; j++) {
+			if (!Int64::TryParse(fields[j], values[i][j]))
+				return false;
+		}
+		try {
+			extradata[i] = Convert::FromBase64String(fields[fieldcount - 1]);
+		} catch (FormatException^) {
+			return false;
+		}
+		CodecID codecid = Context->streams[i]->codec->codec_id;
+		if (codecid != CODEC_ID_NONE && codecid != (CodecID)values[i][0])
+			return false;
+		if (values[i][12] <= 0 || values[i][13] <= 0)
+			return false;
+	}
+	for (int i = 0; i < Streams->Length; i++) {
+		AVStream* stream = Context->streams[i];
+		AVCodecContext* codec = stream->codec;
+		array<Int64>^ value = values[i];
+		codec->codec_id = (CodecID)value[0];
+		codec->codec_type = (AVMediaType)value[1];
+		codec->sample_rate = (int)value[2];
+		codec->channels = (int)value[3];
+		codec->sample_fmt = (AVSampleFormat)value[4];
+		codec->bit_rate = (int)value[5];
+		codec->block_align = (int)value[6];
+		codec->frame_size = (int)value[7];
+		codec->channel_layout = (int64_t)value[8];
+		codec->width = (int)value[9];
+		codec->height = (int)value[10];
+		codec->pix_fmt = (PixelFormat)value[11];
+		stream->time_base.num = (int)value[12];
+		stream->time_base.den = (int)value[13];
+		stream->r_frame_rate.num = (int)value[14];
+		stream->r_frame_rate.den = (int)value[15];
+		stream->start_time = (int64_t)value[16];
+		stream->duration = (int64_t)value[17];
+		// Header-supplied extradata is authoritative; only fill it in where the demuxer left it to the probe
+		if (codec->extradata == NULL && extradata[i]->Length > 0) {
+			codec->extradata = static_cast<uint8_t*>(av_mallocz(extradata[i]->Length + FF_INPUT_BUFFER_PADDING_SIZE));
+			Marshal::Copy(extradata[i], 0, IntPtr(codec->extradata), extradata[i]->Length);
+			codec->extradata_size = extradata[i]->Length;
+		}
+	}
+	Context->start_time = (int64_t)starttime;
+	Context->duration = (int64_t)duration;
+	return true;
+}
+
+AVFormatContext* OpenInput(AVIOContext* IO, AVInputFormat* Format, String^ Filename, String^ Path, DecodeParameters^ Parameters) {
+	using namespace Runtime::InteropServices;
+
+	// Look up stored probe result
+	ProbeCache^ cache = nullptr;
+	String^ timing = nullptr;
+	array<String^>^ streams = nullptr;
+	if (Path != nullptr && Parameters->ProbeCache != nullptr) {
+		cache = Parameters->ProbeCache->Value;
+		FSharpOption<String^>^ result = cache->TryGet(Path);
+		if (result != nullptr) {
+			array<String^>^ parts = result->Value->Split('|');
+			char* name = static_cast<char*>(Marshal::StringToHGlobalAnsi(parts[0]).ToPointer());
+			AVInputFormat* iformat = _FindInput(name);
+			Marshal::FreeHGlobal(IntPtr(static_cast<void*>(name)));
+			if (parts->Length == 3 && iformat != NULL && (Format == NULL || Format == iformat)) {
+				Format = iformat;
+				timing = parts[1];
+				streams = parts[2]->Split(gcnew array<Char> { ';' }, StringSplitOptions::RemoveEmptyEntries);
+			}
+		}
+	}
+
+	// Determine format
+	if (Format == NULL) {
+		char* filename = NULL;
+		if (Filename != nullptr) {
+			filename = static_cast<char*>(Marshal::StringToHGlobalAnsi(Filename).ToPointer());
+		}
+		int err = av_probe_input_buffer(IO, &Format, filename, NULL, 0, Parameters->ProbeSize);
+		if (filename != NULL) {
+			Marshal::FreeHGlobal(IntPtr(static_cast<void*>(filename)));
+		}
+		if (err != 0)
+			return NULL;
+	}
+
+	AVFormatContext* formatcontext = NULL;
+	if (av_open_input_stream(&formatcontext, IO, "", Format, NULL) != 0)
+		return NULL;
+	if (Parameters->ProbeSize > 0)
+		formatcontext->probesize = Parameters->ProbeSize;
+	if (Parameters->AnalyzeDuration > 0.0)
+		formatcontext->max_analyze_duration = (int)(Parameters->AnalyzeDuration * AV_TIME_BASE);
+
+	// Use stored stream information if it still matches the header
+	if (streams != nullptr && _RestoreStreams(formatcontext, timing, streams))
+		return formatcontext;
+
+	if (av_find_stream_info(formatcontext) < 0)
+	{
+		av_close_input_stream(formatcontext);
+		return NULL;
+	}
+
+	if (cache != nullptr)
+		cache->Set(Path, _DescribeStreams(formatcontext));
+	return formatcontext;
+}
+
+/// <summary>
+/// Copies the metadata tags of a format context or stream.
+/// </summary>
+IDictionary<String^, String^>^ _ReadTags(AVDictionary* Metadata) {
+	Dictionary<String^, String^>^ tags = gcnew Dictionary<String^, String^>(StringComparer::OrdinalIgnoreCase);
+	AVDictionaryEntry* entry = NULL;
+	while ((entry = av_dict_get(Metadata, "", entry, AV_DICT_IGNORE_SUFFIX)) != NULL)
+		tags[gcnew String(entry->key, 0, (int)strlen(entry->key), Encoding::UTF8)] = gcnew String(entry->value, 0, (int)strlen(entry->value), Encoding::UTF8);
+	return tags;
+}
+
+void ::Plugin::Initialize() {
+	if (Initialized)
+		return;
+	Monitor::Enter(_Lock);
+	try {
+		if (!Initialized) {
+			avcodec_init();
+			RegisterLockManager();
+			av_register_all();
+
+			// Containers are created as they are found or loaded
+			_Inputs = gcnew Dictionary<IntPtr, _Container^>();
+			_Outputs = gcnew Dictionary<IntPtr, _Container^>();
+			_Names = gcnew Dictionary<String^, FSharpOption<Container^>^>(StringComparer::Ordinal);
+			_Extensions = gcnew Dictionary<String^, FSharpOption<Container^>^>(StringComparer::OrdinalIgnoreCase);
+			Thread::MemoryBarrier();
+			Initialized = true;
+		}
+	} finally {
+		Monitor::Exit(_Lock);
+	}
+}
+
+MD::Action^ ::Plugin::Load() {
+	Initialize();
+
+	MD::Action^ retract = MD::Action::Nil;
+
+	// Register find and load container
+	retract += MD::Container::RegisterFind(gcnew FindContainerAction(_FindContainer));
+	retract += MD::Container::RegisterLoad(gcnew LoadContainerAction(_LoadContainer));
+	retract += MD::Container::RegisterInfo(gcnew ReadInfoAction(_ReadInfo));
+
+	return retract;
+}
+
+_Container^ ::Plugin::_GetContainer(AVInputFormat* Input, AVOutputFormat* Output) {
+	Monitor::Enter(_Lock);
+	try {
+		_Container^ container;
+		if (Input != NULL && _Inputs->TryGetValue(IntPtr(Input), container))
+			return container;
+		if (Output != NULL && _Outputs->TryGetValue(IntPtr(Output), container))
+			return container;
+
+		// Pair with the format of the same name in the other direction
+		const char* name = Input != NULL ? Input->name : Output->name;
+		if (Input == NULL)
+			Input = _FindInput(name);
+		if (Output == NULL)
+			Output = _FindOutput(name);
+
+		container = gcnew _Container(gcnew String(name));
+		container->Input = Input;
+		container->Output = Output;
+		if (Input != NULL)
+			_Inputs->Add(IntPtr(Input), container);
+		if (Output != NULL)
+			_Outputs->Add(IntPtr(Output), container);
+		return container;
+	} finally {
+		Monitor::Exit(_Lock);
+	}
+}
+
+FSharpOption<Container^>^ ::Plugin::_FindContainer(String^ Name, String^ Extension) {
+	using namespace Runtime::InteropServices;
+
+	if (Name == nullptr && Extension == nullptr)
+		return FSharpOption<Container^>::None;
+	Dictionary<String^, FSharpOption<Container^>^>^ results = Name != nullptr ? _Names : _Extensions;
+	String^ key = Name != nullptr ? Name : Extension;
+	Monitor::Enter(_Lock);
+	try {
+		FSharpOption<Container^>^ result;
+		if (results->TryGetValue(key, result))
+			return result;
+
+		AVInputFormat* iformat = NULL;
+		AVOutputFormat* oformat = NULL;
+		if (Name != nullptr) {
+			char* name = static_cast<char*>(Marshal::StringToHGlobalAnsi(Name).ToPointer());
+			iformat = _FindInput(name);
+			if (iformat == NULL)
+				oformat = _FindOutput(name);
+			Marshal::FreeHGlobal(IntPtr(static_cast<void*>(name)));
+		} else {
+			char* filename = static_cast<char*>(Marshal::StringToHGlobalAnsi("." + Extension).ToPointer());
+			iformat = av_iformat_next(NULL);
+			while (iformat != NULL && (iformat->extensions == NULL || !av_match_ext(filename, iformat->extensions)))
+				iformat = av_iformat_next(iformat);
+			if (iformat == NULL)
+				oformat = av_guess_format(NULL, filename, NULL);
+			Marshal::FreeHGlobal(IntPtr(static_cast<void*>(filename)));
+		}
+
+		if (iformat == NULL && oformat == NULL)
+			result = FSharpOption<Container^>::None;
+		else
+			result = FSharpOption<Container^>::Some(_GetContainer(iformat, oformat));
+		results->Add(key, result);
+		return result;
+	} finally {
+		Monitor::Exit(_Lock);
+	}
+}
+
+FSharpOption<Tuple<Container^, ExclusiveContext>^>^ ::Plugin::_LoadContainer(ExclusiveByteData Data, String^ Filename, DecodeParameters^ Parameters) {
+	AVIOContext* io = InitStreamContext(Data.Object);
+
+	// Determine format and find stream format information
+	String^ path = ProbeCache::FileName(Data.Object);
+	AVFormatContext* formatcontext = OpenInput(io, NULL, Filename, path, Parameters);
+	if (formatcontext == NULL)
+	{
+		CloseStreamContext(io);
+		return FSharpOption<Tuple<Container^, ExclusiveContext>^>::None;
+	}
+
+	// Find corresponding managed container
+	_Container^ container = _GetContainer(formatcontext->iformat, NULL);
+
+	return FSharpOption<Tuple<Container^, ExclusiveContext>^>::Some(Tuple::Create<Container^, ExclusiveContext>(container, _Context::Initialize(io, formatcontext, Parameters, path)));
+}
+
+FSharpOption<MediaInfo^>^ ::Plugin::_ReadInfo(ByteData^ Data, String^ Filename, DecodeParameters^ Parameters) {
+	using namespace Runtime::InteropServices;
+
+	// Only the header is read, so the codec parameters are those the demuxer gives without probing packets.
+	AVIOContext* io = InitStreamContext(Data);
+	AVInputFormat* iformat = NULL;
+	char* filename = Filename != nullptr ? static_cast<char*>(Marshal::StringToHGlobalAnsi(Filename).ToPointer()) : NULL;
+	int err = av_probe_input_buffer(io, &iformat, filename, NULL, 0, Parameters->ProbeSize);
+	if (filename != NULL)
+		Marshal::FreeHGlobal(IntPtr(static_cast<void*>(filename)));
+	AVFormatContext* formatcontext = NULL;
+	if (err != 0 || av_open_input_stream(&formatcontext, io, "", iformat, NULL) != 0) {
+		CloseStreamContext(io);
+		return FSharpOption<MediaInfo^>::None;
+	}
+
+	double duration = formatcontext->duration != AV_NOPTS_VALUE ? (double)formatcontext->duration / AV_TIME_BASE : Double::NaN;
+	array<MediaStreamInfo^>^ streams = gcnew array<MediaStreamInfo^>(formatcontext->nb_streams);
+	for (unsigned int t = 0; t < formatcontext->nb_streams; t++) {
+		AVStream* stream = formatcontext->streams[t];
+		AVCodecContext* codeccontext = stream->codec;
+		AVCodec* codec = avcodec_find_decoder(codeccontext->codec_id);
+		double streamduration = stream->duration != AV_NOPTS_VALUE ? stream->duration * av_q2d(stream->time_base) : duration;
+
+		MediaStreamKind kind = MediaStreamKind::Other;
+		int64_t samplecount = -1;
+		double framerate = 0.0;
+		switch (codeccontext->codec_type) {
+		case AVMEDIA_TYPE_AUDIO:
+			kind = MediaStreamKind::Audio;
+			if (codeccontext->sample_rate > 0 && !Double::IsNaN(streamduration))
+				samplecount = (int64_t)(streamduration * codeccontext->sample_rate);
+			break;
+		case AVMEDIA_TYPE_VIDEO:
+			kind = MediaStreamKind::Video;
+			if (stream->r_frame_rate.den > 0)
+				framerate = av_q2d(stream->r_frame_rate);
+			break;
+		}
+
+		streams[t] = gcnew MediaStreamInfo(kind, codec != NULL ? gcnew String(codec->name) : nullptr, streamduration,
+			codeccontext->bit_rate, codeccontext->sample_rate, codeccontext->channels, samplecount,
+			codeccontext->width, codeccontext->height, framerate, _ReadTags(stream->metadata));
+	}
+
+	MediaInfo^ info = gcnew MediaInfo(gcnew String(formatcontext->iformat->name), duration, formatcontext->bit_rate,
+		streams, _ReadTags(formatcontext->metadata));
+	av_close_input_stream(formatcontext);
+	CloseStreamContext(io);
+	return FSharpOption<MediaInfo^>::Some(info);
+}
@@ -1,8 +1,13 @@
 #include <gcroot.h>
+#include "convert.h"
+#include "counters.h"
+#include "hwaccel.h"
+#include "lock.h"
 
 using namespace System;
 using namespace System::Collections::Generic;
 using namespace System::Text;
+using namespace System::Threading;
 using namespace MD;
 using namespace Microsoft::FSharp::Core;
 
@@ -14,21 +19,157 @@ typedef Exclusive<ByteData^> ExclusiveByteData;
 
 ref class _Context;
 
+/// <summary>
+/// The size of the buffer given to the AVIOContext of a stream.
+/// </summary>
+const int StreamBufferSize = 65536;
+
+/// <summary>
+/// The most buffers for AVIOContexts of streams kept for reuse once their contexts are closed.
+/// </summary>
+const int MaxPooledStreamBuffers = 16;
+
+/// <summary>
+/// The minimum time, in seconds, between entries in the seek table of a stream.
+/// </summary>
+const double SeekIndexInterval = 0.5;
+
+/// <summary>
+/// The managed source of an AVIOContext. Sources keep a single reusable transfer buffer and read directly into
+/// FFmpeg's buffer when the underlying stream or data is backed by native memory or an array.
+/// </summary>
+ref class _StreamSource {
+public:
+	_StreamSource(ExclusiveByteStream Stream);
+	_StreamSource(ByteData^ Data, IDisposable^ Owned);
+
+	/// <summary>
+	/// Reads up to the given amount of bytes into a native buffer. Returns the amount of bytes read.
+	/// </summary>
+	int Read(uint8_t* Buffer, int Size);
+
+	/// <summary>
+	/// Seeks to a position in the source, using the conventions of the AVIOContext seek callback. Returns
+	/// the new position, or a negative value if the source can not seek.
+	/// </summary>
+	int64_t Seek(int64_t Offset, int Whence);
+
+	/// <summary>
+	/// Releases the stream used by this source and any resources owned by it.
+	/// </summary>
+	void Release();
+
+private:
+	int _ReadStream(uint8_t* Buffer, int Size);
+	int _ReadData(uint8_t* Buffer, int Size);
+
+	ExclusiveByteStream _Stream;
+	ByteData^ _Data;
+	IDisposable^ _Owned;
+	UInt64 _Position;
+	array<Byte>^ _Transfer;
+};
+
+/// <summary>
+/// A shared pool of buffers for the AVIOContexts of streams, so that opening many files in a row, or in parallel, does
+/// not allocate a new buffer for each. This may be used from any thread.
+/// </summary>
+ref class _StreamBufferPool abstract sealed {
+public:
+	/// <summary>
+	/// Gets a buffer of StreamBufferSize bytes, allocated with av_malloc.
+	/// </summary>
+	static uint8_t* Lease();
+
+	/// <summary>
+	/// Returns a buffer of an AVIOContext, which is kept for reuse if its size is StreamBufferSize and the
+	/// pool is not full, or freed otherwise.
+	/// </summary>
+	static void Return(uint8_t* Buffer, int Size);
+
+private:
+	static Stack<IntPtr>^ _Buffers = gcnew Stack<IntPtr>();
+};
+
+/// <summary>
+/// The opaque state given to the callbacks of an AVIOContext. For memory-mapped sources, the mapping is read directly
+/// by native callbacks that never enter managed code.
+/// </summary>
+struct StreamContext {
+	const uint8_t* Map;
+	int64_t MapSize;
+	int64_t MapPosition;
+	gcroot<_StreamSource^>* Source;
+	ContextCounters* Counters;
+};
+
 /// <summary>
 /// read_packet callback for a stream context.
 /// </summary>
 int read_packet(void* opaque, uint8_t* buf, int buf_size);
 
+/// <summary>
+/// seek callback for a stream context.
+/// </summary>
+int64_t seek_packet(void* opaque, int64_t offset, int whence);
+
+/// <summary>
+/// read_packet callback for a memory-mapped stream context.
+/// </summary>
+int read_mapped(void* opaque, uint8_t* buf, int buf_size);
+
+/// <summary>
+/// seek callback for a memory-mapped stream context.
+/// </summary>
+int64_t seek_mapped(void* opaque, int64_t offset, int whence);
+
 /// <summary>
 /// Initializes an AVIOContext for a stream.
 /// </summary>
-AVIOContext* InitStreamContext(ExclusiveByteStream^ Stream);
+AVIOContext* InitStreamContext(ExclusiveByteStream Stream);
+
+/// <summary>
+/// Initializes a seekable AVIOContext that reads data by index. Memory-mapped data, and data read from a local file
+/// (which will be mapped if possible), is served directly from the mapping.
+/// </summary>
+AVIOContext* InitStreamContext(ByteData^ Data);
 
 /// <summary>
 /// Closes an AVIOContext for a stream.
 /// </summary>
 void CloseStreamContext(AVIOContext* Context);
 
+/// <summary>
+/// Opens the input of an AVIOContext, probing its format when none is given and finding stream information within the
+/// limits of the given parameters. If a path is given and the parameters have a probe cache, a stored probe result for
+/// the path is used instead of probing, and new results are stored. Returns NULL if the input can not be opened.
+/// </summary>
+AVFormatContext* OpenInput(AVIOContext* IO, AVInputFormat* Format, String^ Filename, String^ Path, DecodeParameters^ Parameters);
+
+/// <summary>
+/// The resampler for an audio content, along with the settings it was created for and the amount of samples it has
+/// been given and has produced since then.
+/// </summary>
+struct _ResampleState {
+	ReSampleContext* Context;
+	int SampleRate;
+	int Channels;
+	int Format;
+	int64_t InputSamples;
+	int64_t OutputSamples;
+};
+
+/// <summary>
+/// The state of storing the decoded samples of an audio content in a decode cache, along with the output settings the
+/// samples are stored with.
+/// </summary>
+struct _CacheState {
+	bool Active;
+	int Format;
+	int SampleRate;
+	int Channels;
+};
+
 /// <summary>
 /// A context for decoding.
 /// </summary>
@@ -39,22 +180,507 @@ public:
 	!_Context();
 
 	/// <summary>
-	/// Initializes a context.
+	/// Initializes a context. If the path of the local file the context reads from is given, and the parameters have a
+	/// seek index, stored seek tables for the file are used and updated.
 	/// </summary>
-	static ExclusiveContext Initialize(AVIOContext* IOContext, AVFormatContext* FormatContext);
+	static ExclusiveContext Initialize(AVIOContext* IOContext, AVFormatContext* FormatContext, DecodeParameters^ Parameters, String^ Path);
 
 	virtual bool NextFrame(int% ContentIndex) override;
+	virtual int NextFrames(int MaxFrames, int MaxBytes) override;
+	virtual bool Seek(int ContentIndex, double Time) override;
+	virtual bool NextPacket(ContentPacket^ Packet) override;
+
+	virtual property ContextStats^ Stats {
+		ContextStats^ get() override;
+	}
+
+internal:
+	/// <summary>
+	/// Gets or sets whether the time between calls is counted as the Consume phase. This is turned off for a context read
+	/// by a read-ahead context, whose calls are made by its decoding thread.
+	/// </summary>
+	property bool CountConsume {
+		bool get() { return this->_CountConsume; }
+		void set(bool Value) { this->_CountConsume = Value; }
+	}
 
 private:
+	/// <summary>
+	/// Seeks the content with the given index to the given time. See Seek.
+	/// </summary>
+	bool _Seek(int ContentIndex, double Time);
+
+	/// <summary>
+	/// Reads the next packet from the container, timing the demuxer apart from the reads it makes from the source.
+	/// Returns false at the end of the container or on error.
+	/// </summary>
+	bool _ReadPacket();
+
+	/// <summary>
+	/// Counts the time the reader spent since it was last given a frame or packet, on entry to a call by the reader.
+	/// </summary>
+	void _BeginCall();
+
+	/// <summary>
+	/// Marks the time at which a call by the reader returns.
+	/// </summary>
+	void _EndCall();
+
+	/// <summary>
+	/// Counts a call to a decoder that started at the given time, and wether it produced a frame.
+	/// </summary>
+	void _CountDecode(int64_t Start, bool Decoded);
+
+	/// <summary>
+	/// Counts an event of the given phase, giving it to the trace if it is sampled.
+	/// </summary>
+	void _Trace(int Phase, int64_t Start, int64_t Duration);
+
+	/// <summary>
+	/// Reads the next frame, decoding it into the block of its content if batching. Returns false if there are
+	/// no more frames.
+	/// </summary>
+	bool _Read(int% ContentIndex, bool Batch);
+
+	/// <summary>
+	/// Updates the time of a stream from the timestamps of a packet read for it.
+	/// </summary>
+	void _UpdateTime(int StreamIndex, AVPacket* Packet);
+
+	/// <summary>
+	/// Records the position of a packet in the seek table for its stream, if the stream is being indexed.
+	/// </summary>
+	void _IndexPacket(int StreamIndex, AVPacket* Packet);
+
+	/// <summary>
+	/// Seeks audio content to the exact sample for the given time using the seek table of its stream. Returns false if
+	/// the stream has no usable table.
+	/// </summary>
+	bool _SeekIndexed(int StreamIndex, double Time);
+
+	/// <summary>
+	/// Stops indexing all streams, after the position of the context is no longer known exactly.
+	/// </summary>
+	void _StopIndexing();
+
+	/// <summary>
+	/// Writes a decoded frame of audio content to the decode cache, if the content is being cached. Caching stops if
+	/// the output settings of the content change.
+	/// </summary>
+	void _CacheFrame(int ContentIndex, AudioContent^ Audio, Byte* Data, int Size);
+
+	/// <summary>
+	/// Stops caching the content with the given index, discarding the samples written so far.
+	/// </summary>
+	void _StopCaching(int ContentIndex);
+
+	/// <summary>
+	/// Stops caching all content, after the context no longer reads content from start to end.
+	/// </summary>
+	void _StopCaching();
+
+	/// <summary>
+	/// Stores the samples of all content being cached, once the end of the context has been reached.
+	/// </summary>
+	void _CommitCache();
+
+	/// <summary>
+	/// Adds decoded samples, in the format of the content, to the summary of audio content, if it is being summarized.
+	/// </summary>
+	void _Summarize(int ContentIndex, AudioContent^ Audio, const Byte* Data, int Samples);
+
+	/// <summary>
+	/// Stops summarizing the content with the given index, discarding its partial summary.
+	/// </summary>
+	void _StopSummarizing(int ContentIndex);
+
+	/// <summary>
+	/// Stops summarizing all content, after the context no longer reads content from start to end.
+	/// </summary>
+	void _StopSummarizing();
+
+	/// <summary>
+	/// Completes the summaries of all content being summarized, and stores them in the decode cache, once the end of the
+	/// context has been reached.
+	/// </summary>
+	void _FinishSummaries();
+
+	/// <summary>
+	/// Updates the discard setting of each stream to match the Ignore flag of its content.
+	/// </summary>
+	void _UpdateDiscard();
+
+	/// <summary>
+	/// Decodes the next audio frame from a packet, advancing the packet past the consumed data. Returns true
+	/// if a frame was produced.
+	/// </summary>
+	bool _DecodeAudio(AudioContent^ Audio, int StreamIndex, AVPacket* Packet, bool Batch);
+
+	/// <summary>
+	/// Decodes a video frame from a packet, consuming the whole packet. Returns true if a picture was produced, in which
+	/// case the frame of the content references the planes of the picture.
+	/// </summary>
+	bool _DecodeVideo(VideoContent^ Video, int StreamIndex, AVPacket* Packet);
+
+	/// <summary>
+	/// Gets the resampler for the given content, creating it if the output settings of the content have changed. Returns
+	/// NULL, and restores the sample rate and channels of the content, if FFmpeg can not convert to the requested settings.
+	/// </summary>
+	ReSampleContext* _GetResampler(int ContentIndex, AudioContent^ Audio);
+
+	/// <summary>
+	/// Produces a final frame from the samples the resampler of the given stream holds back, and closes the resampler.
+	/// Returns true if a frame was produced.
+	/// </summary>
+	bool _DrainResampler(AudioContent^ Audio, int StreamIndex, bool Batch);
+
+	/// <summary>
+	/// Closes the resamplers for all content, discarding any samples they hold.
+	/// </summary>
+	void _ResetResamplers();
+
+	/// <summary>
+	/// Gets the buffer for converted frames that are not given to a block or pool, growing it to the given size if needed.
+	/// </summary>
+	Byte* _ReserveOutput(int Size);
+
 	int* _StreamContent;
+	int* _ContentStream;
+	double* _StreamTime;
+	bool* _Ignored;
+	bool _SkipIgnored;
 	AVIOContext* _IOContext;
 	AVFormatContext* _FormatContext;
 	Byte* _Buffer;
 	int _BufferSize;
+	Byte* _Output;
+	int _OutputSize;
+	_ResampleState* _Resample;
+	HWAccel** _HWAccel;
+	AVFrame* _Picture;
+	array<SeekTable^>^ _SeekTables;
+	int64_t* _StreamSamples;
+	int64_t* _SkipSamples;
+	bool* _Indexing;
+	bool _IndexChanged;
+	SeekIndex^ _SeekIndex;
+	String^ _IndexPath;
+	_CacheState* _Cache;
+	array<DecodeCacheWriter^>^ _CacheWriters;
+	SampleSummary** _Summaries;
+	array<float>^ _SummaryTransfer;
 	volatile bool _Disposed;
 	AVPacket* _Packet;
+	AVPacket* _Pending;
+	bool _EndOfStream;
+	unsigned int _FlushStream;
+	ContextCounters* _Counters;
+	int64_t _Returned;
+	bool _CountConsume;
 };
 
+/// <summary>
+/// A decoded frame held in the ring of a read-ahead context.
+/// </summary>
+struct _ReadAheadSlot {
+	Byte* Data;
+	int Size;
+	int Capacity;
+	int ContentIndex;
+	double Time;
+	int64_t Duration;
+};
+
+/// <summary>
+/// A context that decodes frames from a source context on a background thread, staying ahead of the reader by a
+/// bounded amount of frames and time. Frames are passed to the reader through a single-producer, single-consumer
+/// ring, so reading a frame that has already been decoded never waits on the decoder. The thread starts with the first
+/// read. Video frames reference decoder memory that is reused by the next frame, so once video content is read, the
+/// thread is stopped and frames are read from the source directly. Packets are always read from the source directly.
+/// </summary>
+ref class _ReadAheadContext : Context, IDisposable {
+public:
+	_ReadAheadContext(_Context^ Source, int Frames, double Time);
+	~_ReadAheadContext();
+	!_ReadAheadContext();
+
+	virtual bool NextFrame(int% ContentIndex) override;
+	virtual int NextFrames(int MaxFrames, int MaxBytes) override;
+	virtual bool NextPacket(ContentPacket^ Packet) override;
+	virtual bool Seek(int ContentIndex, double Time) override;
+
+	// Statistics and traces are those of the source context, which does the work, except that the Consume phase is timed
+	// between the calls made by the reader of this context.
+	virtual property ContextStats^ Stats {
+		ContextStats^ get() override;
+	}
+
+	virtual property ContextTraceAction^ Trace {
+		ContextTraceAction^ get() override { return this->_Source->Trace; }
+		void set(ContextTraceAction^ Value) override { this->_Source->Trace = Value; }
+	}
+
+	virtual property int TraceInterval {
+		int get() override { return this->_Source->TraceInterval; }
+		void set(int Value) override { this->_Source->TraceInterval = Value; }
+	}
+
+private:
+	/// <summary>
+	/// Creates content for the reader mirroring the content of a source context.
+	/// </summary>
+	static array<MD::Content^>^ _MirrorContent(array<MD::Content^>^ Content);
+
+	/// <summary>
+	/// Counts the time the reader spent since it was last given a frame or packet, on entry to a call by the reader.
+	/// </summary>
+	void _BeginCall();
+
+	/// <summary>
+	/// Marks the time at which a call by the reader returns.
+	/// </summary>
+	void _EndCall();
+
+	/// <summary>
+	/// Reads the next frame, from the ring or, once the thread is stopped, from the source. See NextFrame.
+	/// </summary>
+	bool _ReadFrame(int% ContentIndex);
+
+	/// <summary>
+	/// Decodes frames into the ring of the context referenced by the given state until the context is disposed or collected.
+	/// The thread only holds the context while decoding a frame, so a context that is never disposed can still be finalized.
+	/// </summary>
+	static void _Run(Object^ State);
+
+	/// <summary>
+	/// Decodes the next frame for the context referenced by the given weak reference. Returns false if the context has been
+	/// stopped or collected, and otherwise sets wether the thread should wait for the reader.
+	/// </summary>
+	static bool _Step(WeakReference^ Context, bool% Wait);
+
+	/// <summary>
+	/// Decodes the next frame into the ring. Returns true if the ring is full or there is nothing left to decode, in which
+	/// case the thread should wait for the reader.
+	/// </summary>
+	bool _DecodeNext();
+
+	/// <summary>
+	/// Releases the slot held by the reader and waits for the next decoded slot. Returns false if there are no more frames,
+	/// or if the ring is empty after the thread has been stopped.
+	/// </summary>
+	bool _NextSlot();
+
+	/// <summary>
+	/// Releases the slot held by the reader, starts the decoding thread if needed, or stops it if video content is read.
+	/// Returns true if the next frame is to be read from the source directly.
+	/// </summary>
+	bool _Bypass();
+
+	/// <summary>
+	/// Stops the decoding thread, if it was started, so that the source is only used by the reader from then on.
+	/// </summary>
+	void _StopThread();
+
+	/// <summary>
+	/// Copies the ignore flags and output settings of the content of this context to the source.
+	/// </summary>
+	void _SyncSource();
+
+	/// <summary>
+	/// Reads the next frame from the source on the calling thread, giving its data to the content of this context.
+	/// </summary>
+	bool _ReadDirect(int% ContentIndex);
+
+	/// <summary>
+	/// Gives decoded samples to audio content, copying them into a leased frame if the content has a pool. Returns false if
+	/// the samples are referenced in place and must stay valid until the next read.
+	/// </summary>
+	bool _Deliver(AudioContent^ Audio, Byte* Data, int Size, double Time);
+
+	/// <summary>
+	/// Releases the slot held by the reader, if any.
+	/// </summary>
+	void _ReleaseSlot();
+
+	_Context^ _Source;
+	_ReadAheadSlot* _Slots;
+	int _SlotCount;
+	int64_t _MaxTime;
+
+	// Position of the next slot to be written. Only written by the decoding thread.
+	volatile int _Head;
+
+	// Position of the next slot to be read. Only written by the reader.
+	volatile int _Tail;
+
+	// Total duration, in microseconds, of the frames in the ring.
+	Int64 _QueuedTime;
+
+	bool _Holding;
+	volatile bool _Finished;
+	volatile bool _Stopping;
+	bool _Started;
+	bool _Direct;
+	bool _Disposed;
+	int64_t _Returned;
+	int64_t _ConsumeTicks;
+	int64_t _ConsumeEvents;
+	Object^ _SourceLock;
+	AutoResetEvent^ _Produced;
+	AutoResetEvent^ _Consumed;
+	Thread^ _Thread;
+};
+
+/// <summary>
+/// The state of an output stream of an encode stream.
+/// </summary>
+struct _EncodeState {
+	AVStream* Stream;
+	AVFifoBuffer* Fifo;
+	int FrameSize;
+	int SampleSize;
+	int64_t Samples;
+};
+
+/// <summary>
+/// A stream of bytes produced by a muxer writing to an output format. Output is produced only as bytes are read from the
+/// stream, so memory use does not depend on the length of the content. The stream owns the context it reads from.
+/// </summary>
+ref class _OutputStream abstract : ByteStream, IDisposable {
+public:
+	~_OutputStream();
+	!_OutputStream();
+
+	virtual int Read(array<Byte>^ Target, int Offset, int Size) override;
+
+	/// <summary>
+	/// Appends bytes written by the muxer to the output of this stream.
+	/// </summary>
+	void Write(uint8_t* Data, int Size);
+
+protected:
+	_OutputStream(AVOutputFormat* Format, ExclusiveContext Context);
+
+	/// <summary>
+	/// Writes the header of the output once all output streams have been added. Returns false if the header can not be
+	/// written.
+	/// </summary>
+	bool _Begin();
+
+	/// <summary>
+	/// Writes the trailer of the output, after which no more output is produced.
+	/// </summary>
+	void _End();
+
+	/// <summary>
+	/// Produces more output from the context, calling _End once the context has no more to give.
+	/// </summary>
+	virtual void _Step() abstract;
+
+	ExclusiveContext _Context;
+	AVFormatContext* _FormatContext;
+
+private:
+	AVIOContext* _IOContext;
+	array<Byte>^ _Output;
+	int _OutputStart;
+	int _OutputEnd;
+	bool _Finished;
+	bool _Disposed;
+};
+
+/// <summary>
+/// A stream of bytes produced by encoding the audio content of a context into an output format.
+/// </summary>
+ref class _EncodeStream : _OutputStream {
+public:
+	/// <summary>
+	/// Creates an encode stream for the given context and output format. Returns nullptr if no content of the context
+	/// can be encoded with the format. Content that can not be encoded is ignored.
+	/// </summary>
+	static _EncodeStream^ Create(AVOutputFormat* Format, ExclusiveContext Context);
+
+	~_EncodeStream();
+	!_EncodeStream();
+
+protected:
+	/// <summary>
+	/// Reads and encodes the next frame from the context, or finishes the output once the context has no more frames.
+	/// </summary>
+	virtual void _Step() override;
+
+private:
+	_EncodeStream(AVOutputFormat* Format, ExclusiveContext Context);
+
+	/// <summary>
+	/// Encodes the full frames buffered for an output stream, and when flushing, the remaining samples and any frames
+	/// delayed by the encoder.
+	/// </summary>
+	void _Encode(_EncodeState* State, bool Flush);
+
+	/// <summary>
+	/// Gives an encoded packet of the given size, stored in the packet buffer, to the muxer.
+	/// </summary>
+	void _WritePacket(_EncodeState* State, int Size);
+
+	_EncodeState* _States;
+	int _StateCount;
+	int* _ContentState;
+	uint8_t* _Samples;
+	uint8_t* _Packet;
+	int _PacketSize;
+	array<Byte>^ _Transfer;
+};
+
+/// <summary>
+/// The codec of content read by a FFmpeg context, referencing the stream the content is read from. Content with this
+/// codec can be remuxed into any FFmpeg output format that can store the codec.
+/// </summary>
+ref class _Codec : ContentCodec {
+public:
+	_Codec(AVStream* Stream) : ContentCodec(gcnew String(Stream->codec->codec != NULL ? Stream->codec->codec->name : "")) {
+		this->Stream = Stream;
+	}
+
+	/// <summary>
+	/// The stream of the content. This is valid for as long as the context the content belongs to.
+	/// </summary>
+	AVStream* Stream;
+};
+
+/// <summary>
+/// A stream of bytes produced by writing the compressed packets of a context into an output format, without decoding.
+/// </summary>
+ref class _RemuxStream : _OutputStream {
+public:
+	/// <summary>
+	/// Creates a remux stream for the given context and output format. Returns nullptr if the context has no audio or
+	/// video content read by FFmpeg, or if the format can not store the codecs of that content. Other content is ignored.
+	/// </summary>
+	static _RemuxStream^ Create(AVOutputFormat* Format, ExclusiveContext Context);
+
+	~_RemuxStream();
+	!_RemuxStream();
+
+protected:
+	/// <summary>
+	/// Reads the next packet from the context and gives it to the muxer, or finishes the output once the context has no
+	/// more packets.
+	/// </summary>
+	virtual void _Step() override;
+
+private:
+	_RemuxStream(AVOutputFormat* Format, ExclusiveContext Context);
+
+	int* _ContentStream;
+	ContentPacket^ _Packet;
+};
+
+/// <summary>
+/// write_packet callback for the AVIOContext of an output stream.
+/// </summary>
+int write_packet(void* opaque, uint8_t* buf, int buf_size);
+
 /// <summary>
 /// A FFmpeg container format.
 /// </summary>
@@ -65,8 +691,9 @@ public:
 		this->Output = NULL;
 	}
 
-    virtual FSharpOption<ExclusiveContext>^ Decode(ExclusiveByteStream Stream) override;
+    virtual FSharpOption<ExclusiveContext>^ Decode(ExclusiveByteStream Stream, DecodeParameters^ Parameters) override;
     virtual FSharpOption<ExclusiveByteStream>^ Encode(ExclusiveContext Context) override;
+    virtual FSharpOption<ExclusiveByteStream>^ Remux(ExclusiveContext Context) override;
 
 	AVInputFormat* Input;
 	AVOutputFormat* Output;
@@ -76,6 +703,12 @@ public ref class Plugin : MD::Plugin {
 public:
 	static bool Initialized = false;
 
+	/// <summary>
+	/// Registers FFmpeg's formats and codecs, and a lock manager so codecs can be opened on several threads, if not already
+	/// done. This may be called from any thread.
+	/// </summary>
+	static void Initialize();
+
 	virtual property String^ Name {
 		String^ get() override {
 			return "FFmpeg";
@@ -99,8 +732,27 @@ public:
 	virtual MD::Action^ Load() override;
 
 private:
-	static Dictionary<String^, _Container^>^ _Containers = nullptr;
+	static Object^ _Lock = gcnew Object();
+	static Dictionary<IntPtr, _Container^>^ _Inputs = nullptr;
+	static Dictionary<IntPtr, _Container^>^ _Outputs = nullptr;
+
+	// The results of finding containers by name and by extension, including those that found no container. Each name or
+	// extension is only searched for the first time it is looked up.
+	static Dictionary<String^, FSharpOption<Container^>^>^ _Names = nullptr;
+	static Dictionary<String^, FSharpOption<Container^>^>^ _Extensions = nullptr;
 
-	static FSharpOption<Tuple<Container^, ExclusiveContext>^>^ _LoadContainer(ExclusiveByteData Data, String^ Filename);
+	/// <summary>
+	/// Gets the managed container for the given input and/or output format, creating it if needed. Formats with the same name
+	/// share a container.
+	/// </summary>
+	static _Container^ _GetContainer(AVInputFormat* Input, AVOutputFormat* Output);
+
+	static FSharpOption<Container^>^ _FindContainer(String^ Name, String^ Extension);
+	static FSharpOption<Tuple<Container^, ExclusiveContext>^>^ _LoadContainer(ExclusiveByteData Data, String^ Filename, DecodeParameters^ Parameters);
+
+	/// <summary>
+	/// Reads media information from the header of a container, without finding stream information or opening codecs.
+	/// </summary>
+	static FSharpOption<MediaInfo^>^ _ReadInfo(ByteData^ Data, String^ Filename, DecodeParameters^ Parameters);
 };
 
@@ -0,0 +1,9 @@
+﻿namespace MD
+
+/// Identifies an audio format for a sample of a single channel.
+type AudioFormat =
+    | PCM8 = 0
+    | PCM16 = 1
+    | PCM32 = 2
+    | Float = 3
+    | Double = 4
@@ -0,0 +1,142 @@
+﻿namespace MD
+
+open System
+open System.Collections.Generic
+
+/// A multi-resolution summary of audio content, giving the minimum, maximum and RMS of the samples of each channel over
+/// blocks of samples. Level 0 has blocks of BlockSize samples, and each further level has blocks of twice the size of the
+/// level below it, up to a level with a single block. Summaries are built while content is decoded from start to end, so
+/// views can draw waveforms and overviews from the level closest to their resolution without reading every sample.
+[<Sealed; AllowNullLiteral>]
+type AudioSummary (channels : int, blockSize : int) =
+    static let magic = 0x5353444D
+    static let version = 2
+    let stride = channels * 3
+    let levels = new List<List<float32>> ()
+    let mutable complete = false
+    let mutable tailSamples = blockSize
+
+    /// Appends the combination of two blocks of a level, or a single block if the second index is -1, to the level above.
+    /// The RMS of the blocks is weighted by the given amounts of samples in each.
+    let combineWeighted (level : int) (a : int) (b : int) (weightA : float32) (weightB : float32) =
+        if levels.Count <= level + 1 then levels.Add (new List<float32> ())
+        let source = levels.[level]
+        let target = levels.[level + 1]
+        for c = 0 to channels - 1 do
+            let i = a * stride + c * 3
+            if b < 0 then
+                target.Add source.[i]
+                target.Add source.[i + 1]
+                target.Add source.[i + 2]
+            else
+                let j = b * stride + c * 3
+                target.Add (min source.[i] source.[j])
+                target.Add (max source.[i + 1] source.[j + 1])
+                target.Add (sqrt ((source.[i + 2] * source.[i + 2] * weightA + source.[j + 2] * source.[j + 2] * weightB) / (weightA + weightB)))
+
+    /// Appends the combination of two full blocks of a level to the level above.
+    let combine (level : int) (a : int) (b : int) = combineWeighted level a b 1.0f 1.0f
+
+    /// Gets the amount of channels summarized.
+    member this.Channels = channels
+
+    /// Gets the amount of samples in each block of level 0.
+    member this.BlockSize = blockSize
+
+    /// Gets wether the summary covers all of the content.
+    member this.IsComplete = complete
+
+    /// Gets the amount of samples in the last block of level 0. This is BlockSize until the summary is complete.
+    member this.TailSamples = tailSamples
+
+    /// Gets the amount of levels in this summary.
+    member this.Levels = lock levels (fun () -> levels.Count)
+
+    /// Gets the amount of samples in each block of the given level.
+    member this.LevelBlockSize (level : int) = int64 blockSize <<< level
+
+    /// Gets the amount of blocks in the given level.
+    member this.Blocks (level : int) = lock levels (fun () -> if level < levels.Count then levels.[level].Count / stride else 0)
+
+    /// Gets the coarsest level whose blocks have at most the given amount of samples, such as the amount of samples
+    /// covered by a pixel.
+    member this.LevelFor (samples : float) =
+        let mutable level = 0
+        while level + 1 < this.Levels && float (this.LevelBlockSize (level + 1)) <= samples do
+            level <- level + 1
+        level
+
+    /// Gets the summary of a channel at the given level, as the minimum, maximum and RMS of the samples of each block.
+    member this.GetLevel (channel : int, level : int) =
+        lock levels (fun () ->
+            let source = levels.[level]
+            let blocks = source.Count / stride
+            let array = Array.zeroCreate<float> (blocks * 3)
+            for b = 0 to blocks - 1 do
+                let i = b * stride + channel * 3
+                array.[b * 3] <- float source.[i]
+                array.[b * 3 + 1] <- float source.[i + 1]
+                array.[b * 3 + 2] <- float source.[i + 2]
+            Data.array array 0 array.Length)
+
+    /// Appends blocks to level 0, given as the minimum, maximum and RMS of each channel for each block, and combines them
+    /// into the levels above.
+    member this.Add (blocks : float32[], count : int) =
+        lock levels (fun () ->
+            if levels.Count = 0 then levels.Add (new List<float32> ())
+            for b = 0 to count - 1 do
+                for i = 0 to stride - 1 do
+                    levels.[0].Add blocks.[b * stride + i]
+                let mutable level = 0
+                while (levels.[level].Count / stride) % 2 = 0 do
+                    let n = levels.[level].Count / stride
+                    combine level (n - 2) (n - 1)
+                    level <- level + 1)
+
+    /// Completes the levels above the last blocks, once all of the content has been added, given the amount of samples in
+    /// the last block of level 0. The last block of each level above is rebuilt from the last one or two blocks below it,
+    /// weighting the RMS by the amount of samples in each, until a level has a single block covering all of the content.
+    member this.Finish (lastSamples : int) =
+        lock levels (fun () ->
+            tailSamples <- lastSamples
+            let total = if levels.Count > 0 then int64 (levels.[0].Count / stride - 1) * int64 blockSize + int64 lastSamples else 0L
+            let samples (level : int) (index : int) =
+                let size = int64 blockSize <<< level
+                float32 (min size (total - int64 index * size))
+            let mutable level = 0
+            while level < levels.Count && levels.[level].Count / stride > 1 do
+                let n = levels.[level].Count / stride
+                if levels.Count <= level + 1 then levels.Add (new List<float32> ())
+                let above = levels.[level + 1]
+                let keep = ((n - 1) / 2) * stride
+                above.RemoveRange (keep, above.Count - keep)
+                if n % 2 = 0 then combineWeighted level (n - 2) (n - 1) (samples level (n - 2)) (samples level (n - 1))
+                else combineWeighted level (n - 1) (-1) 1.0f 0.0f
+                level <- level + 1
+            complete <- true)
+
+    /// Writes this summary to a stream.
+    member this.Write (writer : IO.BinaryWriter) =
+        lock levels (fun () ->
+            writer.Write magic
+            writer.Write version
+            writer.Write channels
+            writer.Write blockSize
+            writer.Write (if levels.Count > 0 then levels.[0].Count / stride else 0)
+            writer.Write tailSamples
+            if levels.Count > 0 then
+                for value in levels.[0] do
+                    writer.Write value)
+
+    /// Reads a complete summary written by Write, or returns None if the stream does not hold a summary.
+    static member Read (reader : IO.BinaryReader) =
+        if reader.ReadInt32 () <> magic || reader.ReadInt32 () <> version then None
+        else
+            let summary = new AudioSummary (reader.ReadInt32 (), reader.ReadInt32 ())
+            let stride = summary.Channels * 3
+            let blocks = reader.ReadInt32 ()
+            let tail = reader.ReadInt32 ()
+            let values = Array.init (blocks * stride) (fun _ -> reader.ReadSingle ())
+            summary.Add (values, blocks)
+            summary.Finish tail
+            Some summary
@@ -116,6 +116,7 @@ type ManualCache<'a, 'b when 'a : equality> (create : 'a -> 'b, delete : 'b -> u
             index.Remove key |> ignore
             items.Remove node
             delete value
+            count <- count - 1
             node <- next
 
     override this.Submit (param, item) =
@@ -1,102 +1,949 @@
 ﻿namespace MD
 
+open System
+open System.Collections.Generic
+open System.Runtime.InteropServices
+open System.Threading.Tasks
+
+/// Describes the compressed form of content as it is stored in its container. Containers may give derived codecs that carry
+/// the parameters needed to write the compressed content to another container without decoding it.
+[<AllowNullLiteral>]
+type ContentCodec (name : string) =
+
+    /// Gets the short name of the codec of the content.
+    member this.Name = name
+
 /// An interface to multimedia content within a container format.
 type Content () = 
     let mutable ignore : bool = false
+    let mutable codec : ContentCodec = null
 
-    /// Gets or sets wether this content is to be ignored in the reading context. If so, frames for this content will still 
-    /// be read, but will not be interpreted.
+    /// Gets or sets wether this content is to be ignored in the reading context. If so, frames for this content will not be
+    /// interpreted, and contexts may avoid reading them altogether. Changes take effect on the next frame read.
     member this.Ignore
         with get () = ignore
         and set x = ignore <- x
 
+    /// Gets or sets the codec of this content as stored in its container, or null if it is not known.
+    member this.Codec
+        with get () = codec
+        and set x = codec <- x
+
+/// A compressed packet of content read from a context, stored in memory owned by the context. Packets are updated in place,
+/// so the data of a packet is only valid until the next packet is read. Timestamps are given in units of the time base of the
+/// packet, and are Int64.MinValue when not known.
+[<Sealed>]
+type ContentPacket () =
+    inherit Data<byte> (1)
+    let mutable buffer = new Buffer<byte> (0n, 1u)
+    let mutable size = 0
+    let mutable contentIndex = 0
+    let mutable timestamp = Int64.MinValue
+    let mutable decodeTimestamp = Int64.MinValue
+    let mutable duration = 0L
+    let mutable timeBaseNumerator = 1
+    let mutable timeBaseDenominator = 1
+    let mutable key = false
+
+    /// Gets the buffer for the data in this packet.
+    member this.Buffer = buffer
+
+    /// Gets the size of the data in this packet.
+    member this.NativeSize = size
+
+    /// Gets the index of the content this packet belongs to.
+    member this.ContentIndex = contentIndex
+
+    /// Gets the presentation timestamp of this packet.
+    member this.Timestamp = timestamp
+
+    /// Gets the decoding timestamp of this packet.
+    member this.DecodeTimestamp = decodeTimestamp
+
+    /// Gets the duration of this packet, or 0 if it is not known.
+    member this.Duration = duration
+
+    /// Gets the numerator of the time base, in seconds, of the timestamps of this packet.
+    member this.TimeBaseNumerator = timeBaseNumerator
+
+    /// Gets the denominator of the time base, in seconds, of the timestamps of this packet.
+    member this.TimeBaseDenominator = timeBaseDenominator
+
+    /// Gets wether this packet can be decoded without any packets before it.
+    member this.Key = key
+
+    /// Gets the presentation time of this packet in seconds, or NaN if it is not known.
+    member this.Time =
+        if timestamp = Int64.MinValue then nan
+        else float timestamp * float timeBaseNumerator / float timeBaseDenominator
+
+    /// Sets the data and properties of this packet.
+    member this.Update (newBuffer : Buffer<byte>, newSize : int, newContentIndex : int, newTimestamp : int64, newDecodeTimestamp : int64,
+                        newDuration : int64, newTimeBaseNumerator : int, newTimeBaseDenominator : int, newKey : bool) =
+        buffer <- newBuffer
+        size <- newSize
+        contentIndex <- newContentIndex
+        timestamp <- newTimestamp
+        decodeTimestamp <- newDecodeTimestamp
+        duration <- newDuration
+        timeBaseNumerator <- newTimeBaseNumerator
+        timeBaseDenominator <- newTimeBaseDenominator
+        key <- newKey
+
+    override this.Size = uint64 size
+    override this.Read (index, array, offset, size) = Buffer.copyba (buffer.Advance (int index)) array offset size
+    override this.Lock (index, size) = Stream.buffer (buffer.Advance (int index)) |> Exclusive.make
+
+/// Audio data for a single frame, stored in native memory. Frames are reused by the context or pool they come from, so the
+/// data of a frame is only valid until the frame is next updated.
+[<Sealed>]
+type AudioFrame (pool : AudioFramePool) as this =
+    inherit Data<byte> (1)
+    let option = Some (this :> Data<byte>)
+    let mutable buffer = new Buffer<byte> (0n, 1u)
+    let mutable size = 0
+    let mutable storage = 0n
+    let mutable capacity = 0
+    let mutable time = nan
+    let mutable returned = false
+    new () = new AudioFrame (null)
+
+    /// Gets the pool this frame was leased from, or null if this frame is not pooled.
+    member this.Pool = pool
+
+    /// Gets this frame as a data option. This allows the frame to be given as content data without allocation.
+    member this.DataOption = option
+
+    /// Gets the buffer for the data in this frame.
+    member this.Buffer = buffer
+
+    /// Gets the size of the data in this frame.
+    member this.NativeSize = size
+
+    /// Gets or sets the presentation time, in seconds, of the first sample in this frame, or NaN if it is not known.
+    member this.Time
+        with get () = time
+        and set x = time <- x
+
+    /// Gets the native memory owned by this frame, or zero if this frame has not reserved any.
+    member this.Storage = storage
+
+    /// Gets the size, in bytes, of the native memory owned by this frame.
+    member this.Capacity = capacity
+
+    /// Ensures this frame owns native memory of at least the given size in bytes and returns a pointer to it. Existing
+    /// storage is reused when it is large enough.
+    member this.Reserve (required : int) =
+        if required > capacity then
+            storage <- if storage = 0n then Marshal.AllocHGlobal required else Marshal.ReAllocHGlobal (storage, nativeint required)
+            capacity <- required
+        storage
+
+    /// Sets the data for this frame.
+    member this.Update (newBuffer : Buffer<byte>, newSize : int) =
+        buffer <- newBuffer
+        size <- newSize
+
+    /// Marks this frame as leased from its pool.
+    member internal this.Lease () = returned <- false
+
+    /// Returns this frame to the pool it was leased from. The frame should not be used after it is returned, and may only
+    /// be returned once for each time it is leased.
+    member this.Return () =
+        if pool <> null then
+            if returned then new InvalidOperationException ("The frame has already been returned to its pool.") |> raise
+            returned <- true
+            pool.Return this
+
+    override this.Size = uint64 size
+    override this.Read (index, array, offset, size) = Buffer.copyba (buffer.Advance (int index)) array offset size
+    override this.Lock (index, size) = Stream.buffer (buffer.Advance (int index)) |> Exclusive.make
+
+    interface IDisposable with
+        member this.Dispose () =
+            if storage <> 0n then
+                Marshal.FreeHGlobal storage
+                storage <- 0n
+                capacity <- 0
+            size <- 0
+
+/// A pool of audio frames with their own storage. Frames leased from a pool remain valid until they are returned, allowing
+/// several frames to be held at once without copying.
+and [<Sealed; AllowNullLiteral>] AudioFramePool () =
+    let free = new Stack<AudioFrame> ()
+    let frames = new List<AudioFrame> ()
+
+    /// Gets the total amount of frames created by this pool.
+    member this.Count = frames.Count
+
+    /// Gets the amount of frames in this pool that are not currently leased.
+    member this.Available = free.Count
+
+    /// Leases a frame from this pool, creating a new frame if none are available.
+    member this.Lease () =
+        lock free (fun () ->
+            let frame =
+                if free.Count > 0 then free.Pop ()
+                else
+                    let frame = new AudioFrame (this)
+                    frames.Add frame
+                    frame
+            frame.Lease ()
+            frame)
+
+    /// Returns a frame previously leased from this pool.
+    member this.Return (frame : AudioFrame) =
+        lock free (fun () -> free.Push frame)
+
+    interface IDisposable with
+        member this.Dispose () =
+            lock free (fun () ->
+                for frame in frames do
+                    (frame :> IDisposable).Dispose ()
+                frames.Clear ()
+                free.Clear ())
+
+/// A contiguous block of audio data holding several frames, along with the offset and time of each frame. Blocks are
+/// filled by Context.NextFrames and are reused for each call.
+[<Sealed>]
+type AudioBlock () as this =
+    inherit Data<byte> (1)
+    let option = Some (this :> Data<byte>)
+    let offsets = new List<int> ()
+    let times = new List<float> ()
+    let mutable storage = 0n
+    let mutable capacity = 0
+    let mutable size = 0
+
+    /// Ensures the storage for this block can hold at least the given amount of bytes, preserving existing data.
+    let ensure required =
+        if required > capacity then
+            let required = max required (capacity * 2)
+            storage <- if storage = 0n then Marshal.AllocHGlobal required else Marshal.ReAllocHGlobal (storage, nativeint required)
+            capacity <- required
+
+    /// Gets this block as a data option. This allows the block to be given as content data without allocation.
+    member this.DataOption = option
+
+    /// Gets the buffer for the data in this block.
+    member this.Buffer = new Buffer<byte> (storage, 1u)
+
+    /// Gets the total size of the data in this block.
+    member this.NativeSize = size
+
+    /// Gets the amount of frames in this block.
+    member this.Frames = offsets.Count
+
+    /// Gets the offset, in bytes, of the frame at the given index in this block.
+    member this.FrameOffset (frame : int) = offsets.[frame]
+
+    /// Gets the size, in bytes, of the frame at the given index in this block.
+    member this.FrameSize (frame : int) =
+        let next = if frame + 1 < offsets.Count then offsets.[frame + 1] else size
+        next - offsets.[frame]
+
+    /// Gets the presentation time, in seconds, of the frame at the given index in this block, or NaN if it is not known.
+    member this.FrameTime (frame : int) = times.[frame]
+
+    /// Removes all frames from this block. Storage is kept for reuse.
+    member this.Clear () =
+        offsets.Clear ()
+        times.Clear ()
+        size <- 0
+
+    /// Reserves space for a frame of at most the given size at the end of this block and returns a pointer to it. The frame
+    /// is added to the block with a following call to Commit.
+    member this.Reserve (required : int) =
+        ensure (size + required)
+        storage + nativeint size
+
+    /// Adds a frame, previously written to the pointer given by Reserve, to this block.
+    member this.Commit (frameSize : int, frameTime : float) =
+        offsets.Add size
+        times.Add frameTime
+        size <- size + frameSize
+
+    /// Appends a copy of the given frame data to this block.
+    member this.Append (data : Data<byte>, frameTime : float) =
+        let frameSize = int data.Size
+        let target = new Buffer<byte> (this.Reserve frameSize, 1u)
+        match data with
+        | :? AudioFrame as frame -> Buffer.copybb frame.Buffer target frameSize
+        | data ->
+            let array = Array.zeroCreate frameSize
+            data.Read (0UL, array, 0, frameSize)
+            Buffer.copyab array 0 target frameSize
+        this.Commit (frameSize, frameTime)
+
+    override this.Size = uint64 size
+    override this.Read (index, array, offset, size) = Buffer.copyba (this.Buffer.Advance (int index)) array offset size
+    override this.Lock (index, size) = Stream.buffer (this.Buffer.Advance (int index)) |> Exclusive.make
+
+    interface IDisposable with
+        member this.Dispose () =
+            if storage <> 0n then
+                Marshal.FreeHGlobal storage
+                storage <- 0n
+                capacity <- 0
+            this.Clear ()
+
+/// An interface to audio content in a container.
+type AudioContent (sampleRate : float, channels : int, format : AudioFormat) =
+    inherit Content ()
+    let frame = new AudioFrame ()
+    let block = new AudioBlock ()
+    let mutable data : Data<byte> option = None
+    let mutable pool : AudioFramePool = null
+    let mutable outputFormat = format
+    let mutable planar = false
+    let mutable outputSampleRate = sampleRate
+    let mutable outputChannels = channels
+    let mutable sampleCount = -1L
+    let mutable cacheSource : DecodeCacheSource = null
+    let mutable summary : AudioSummary = null
+
+    /// Determines the amount of bytes in a sample of the given audio format.
+    static member BytesPerSample (format : AudioFormat) =
+        match format with
+        | AudioFormat.PCM8 -> 1
+        | AudioFormat.PCM16 -> 2
+        | AudioFormat.PCM32 -> 4
+        | AudioFormat.Float -> 4
+        | AudioFormat.Double -> 8
+        | x -> 0
+
+    /// Gets the sample rate, in samples per second, for this audio content.
+    member this.SampleRate = sampleRate
+
+    /// Gets the amount of channels in this audio content. Multichannel audio content will have
+    /// sample data for channels interleaved in the data array, unless Planar is set.
+    member this.Channels = channels
+
+    /// Gets the format for this audio content.
+    member this.Format = format
+
+    /// Gets or sets the format of the data given for frames of this content. This may be the format of the content
+    /// (the default), Float or Double; decoded samples are converted as needed. Changes take effect at the next frame.
+    member this.OutputFormat
+        with get () = outputFormat
+        and set x =
+            if x <> format && x <> AudioFormat.Float && x <> AudioFormat.Double then
+                new ArgumentException ("Audio can only be converted to Float or Double.") |> raise
+            outputFormat <- x
+
+    /// Gets or sets wether the data given for frames of this content is planar. Planar data holds all samples for the
+    /// first channel of a frame, followed by all samples for the next channel, instead of interleaving them. Changes
+    /// take effect at the next frame.
+    member this.Planar
+        with get () = planar
+        and set x = planar <- x
+
+    /// Gets or sets the sample rate of the data given for frames of this content. Decoded samples are resampled as
+    /// needed. Changes take effect at the next frame.
+    member this.OutputSampleRate
+        with get () = outputSampleRate
+        and set x = outputSampleRate <- x
+
+    /// Gets or sets the amount of channels in the data given for frames of this content. Decoded samples are mixed
+    /// as needed. If a context can not convert to the requested amount of channels or sample rate, it restores both
+    /// to those of the content. Changes take effect at the next frame.
+    member this.OutputChannels
+        with get () = outputChannels
+        and set x = outputChannels <- x
+
+    /// Gets or sets the estimated amount of samples for each channel in this content, at the sample rate of the content,
+    /// or -1 if it is not known. Contexts set this from the duration given by the container.
+    member this.SampleCount
+        with get () = sampleCount
+        and set x = sampleCount <- x
+
+    /// Gets the estimated duration of this content in seconds, from its sample count, or NaN if it is not known.
+    member this.Duration = if sampleCount >= 0L then float sampleCount / sampleRate else nan
+
+    /// Gets the estimated size, in bytes, of all decoded samples of this content with the current output settings, or -1
+    /// if it is not known. This may be used to size buffers for the decoded content ahead of time.
+    member this.OutputSize =
+        if sampleCount >= 0L then int64 (float sampleCount * outputSampleRate / sampleRate) * int64 (outputChannels * AudioContent.BytesPerSample outputFormat)
+        else -1L
+
+    /// Gets or sets the source of this content in a decode cache, or null if decoded samples of this content are not cached.
+    /// Contexts given a decode cache store the samples of content that is decoded from start to end without seeking.
+    member this.CacheSource
+        with get () = cacheSource
+        and set x = cacheSource <- x
+
+    /// Gets or sets the summary of the samples of this content, at the sample rate and channels of the content, or null if
+    /// there is none. Contexts given a summary block size build the summary while the content is decoded from start to end,
+    /// and it is only complete once the end is reached. Summaries are stored along with cached samples when possible.
+    member this.Summary
+        with get () = summary
+        and set x = summary <- x
+
+    /// Tries getting the cached decoded samples of this content with the current output format, sample rate and channels,
+    /// interleaved. Returns None if they are not cached.
+    member this.TryGetCached () =
+        match cacheSource with
+        | null -> None
+        | source -> source.TryOpen (outputFormat, int outputSampleRate, outputChannels)
+
+    /// Gets the frame that contexts update in place with the data of each frame read for this content.
+    member this.Frame = frame
+
+    /// Gets the block that Context.NextFrames appends the frames read for this content to.
+    member this.Block = block
+
+    /// Gets or sets the pool frames for this content are leased from. When set, each frame read for this content is leased
+    /// from the pool and stays valid until it is returned with AudioFrame.Return. When null (the default), the frame given
+    /// by Frame is updated in place and is only valid until the next frame is read.
+    member this.Pool
+        with get () = pool
+        and set x = pool <- x
+
+    /// Gets or sets the audio data for the current frame. This should be updated when a call to
+    /// Context.NextFrame returns a content index for this audio content.
+    member this.Data
+        with get () = data
+        and set x = data <- x
+
+/// Identifies the pixel format of video frames. Values match those of the FFmpeg PixelFormat enumeration; formats
+/// without a listed name may still be given.
+type VideoFormat =
+    | YUV420P = 0
+    | YUYV422 = 1
+    | RGB24 = 2
+    | BGR24 = 3
+    | YUV422P = 4
+    | YUV444P = 5
+    | YUV410P = 6
+    | YUV411P = 7
+    | Gray8 = 8
+    | PAL8 = 11
+    | YUVJ420P = 12
+    | YUVJ422P = 13
+    | YUVJ444P = 14
+    | UYVY422 = 17
+    | NV12 = 25
+    | NV21 = 26
+    | ARGB = 27
+    | RGBA = 28
+    | ABGR = 29
+    | BGRA = 30
+
+/// A plane of pixel data in a video frame. Each row of the plane starts Stride bytes after the previous one, and holds
+/// Width bytes of pixel data.
+type VideoPlane (buffer : Buffer<byte>, stride : int, width : int, height : int) =
+    struct
+
+        /// Gets the buffer for the first row of this plane.
+        member this.Buffer = buffer
+
+        /// Gets the offset, in bytes, between the starts of consecutive rows in this plane.
+        member this.Stride = stride
+
+        /// Gets the size, in bytes, of the pixel data in a row of this plane.
+        member this.Width = width
+
+        /// Gets the amount of rows in this plane.
+        member this.Height = height
+    end
+
+/// A decoded video frame whose planes reference memory owned by the decoder. Frames are updated in place for each frame
+/// read, so the planes of a frame are only valid until the next frame is read from its context.
+[<Sealed>]
+type VideoFrame (format : VideoFormat) as this =
+    let option = Some this
+    let planes = Array.zeroCreate<VideoPlane> 4
+    let mutable format = format
+    let mutable planeCount = 0
+    let mutable time = nan
+
+    /// Gets this frame as an option. This allows the frame to be given as content data without allocation.
+    member this.Option = option
+
+    /// Gets or sets the pixel format of this frame. This may differ from the format of the content when frames are
+    /// decoded in hardware.
+    member this.Format
+        with get () = format
+        and set x = format <- x
+
+    /// Gets the amount of planes in this frame.
+    member this.PlaneCount = planeCount
+
+    /// Gets the plane with the given index in this frame.
+    member this.Plane (index : int) = planes.[index]
+
+    /// Gets or sets the time, in seconds, of this frame within its content, or nan if it is not known.
+    member this.Time
+        with get () = time
+        and set x = time <- x
+
+    /// Sets the amount of planes in this frame.
+    member this.SetPlaneCount count = planeCount <- count
+
+    /// Sets the plane with the given index in this frame.
+    member this.SetPlane (index : int, plane : VideoPlane) = planes.[index] <- plane
+
+/// Identifies the method used to decode video content.
+type VideoDecoder =
+    | Software = 0
+    | DXVA2 = 1
+
+/// Content consisting of a sequence of video frames.
+type VideoContent (width : int, height : int, format : VideoFormat, frameRate : float) =
+    inherit Content ()
+    let frame = new VideoFrame (format)
+    let mutable data : VideoFrame option = None
+    let mutable decoder = VideoDecoder.Software
+
+    /// Gets the width, in pixels, of frames in this video content.
+    member this.Width = width
+
+    /// Gets the height, in pixels, of frames in this video content.
+    member this.Height = height
+
+    /// Gets the pixel format of frames in this video content.
+    member this.Format = format
+
+    /// Gets the nominal amount of frames per second in this video content, or 0.0 if it is not known.
+    member this.FrameRate = frameRate
+
+    /// Gets the frame that contexts update in place with each frame read for this content.
+    member this.Frame = frame
+
+    /// Gets or sets the method used to decode the most recent frame of this content.
+    member this.Decoder
+        with get () = decoder
+        and set x = decoder <- x
+
+    /// Gets or sets the current frame. This should be updated when a call to Context.NextFrame returns a content index
+    /// for this video content.
+    member this.Data
+        with get () = data
+        and set x = data <- x
+
+/// Identifies a phase of the work done by a context, for its statistics and trace.
+type ContextPhase =
+
+    /// Reading input data from the source of the context.
+    | Read = 0
+
+    /// Splitting the container into packets, excluding the time spent reading input.
+    | Demux = 1
+
+    /// Decoding packets into frames.
+    | Decode = 2
+
+    /// The time between frames spent by the reader of the context, outside of the context.
+    | Consume = 3
+
+/// Cumulative statistics for the work done by a context since it was created. Times are given in seconds.
+type ContextStats = {
+
+    /// The amount of bytes read from the source of the context.
+    BytesRead : int64
+
+    /// The amount of reads from the source of the context.
+    Reads : int64
+
+    /// The amount of packets demuxed from the container.
+    PacketsDemuxed : int64
+
+    /// The amount of demuxed packets that were dropped without being decoded or given to the reader.
+    PacketsDiscarded : int64
+
+    /// The amount of frames produced by decoders.
+    FramesDecoded : int64
+
+    /// The time spent in the Read phase.
+    ReadTime : float
+
+    /// The time spent in the Demux phase.
+    DemuxTime : float
+
+    /// The time spent in the Decode phase.
+    DecodeTime : float
+
+    /// The time spent in the Consume phase.
+    ConsumeTime : float
+
+    } with
+
+    /// Gets statistics with all counters at zero, for contexts that do not keep statistics.
+    static member Empty = {
+            BytesRead = 0L
+            Reads = 0L
+            PacketsDemuxed = 0L
+            PacketsDiscarded = 0L
+            FramesDecoded = 0L
+            ReadTime = 0.0
+            DemuxTime = 0.0
+            DecodeTime = 0.0
+            ConsumeTime = 0.0
+        }
+
+/// An action that is given a traced event of a context, with the phase of the event, and its start time and duration in
+/// Stopwatch ticks. Start times are comparable with Stopwatch.GetTimestamp.
+type ContextTraceAction = delegate of phase : ContextPhase * start : int64 * duration : int64 -> unit
+
 /// A context for a container that allows content to be read.
 [<AbstractClass>]
 type Context (content : Content[]) =
+    let mutable trace : ContextTraceAction = null
+    let mutable traceInterval = 1
     
     /// Gets the content available in this context.
     member this.Content = content
 
+    /// Gets the cumulative statistics of this context. Contexts that do not keep statistics give ContextStats.Empty.
+    abstract member Stats : ContextStats
+    default this.Stats = ContextStats.Empty
+
+    /// Gets or sets an action given sampled events of the work done by this context, or null to not trace events. The
+    /// action is called on the thread doing the work, and should return quickly.
+    abstract member Trace : ContextTraceAction with get, set
+    default this.Trace
+        with get () = trace
+        and set x = trace <- x
+
+    /// Gets or sets the sampling interval of the trace, such that every n-th event of each phase is traced.
+    abstract member TraceInterval : int with get, set
+    default this.TraceInterval
+        with get () = traceInterval
+        and set x = traceInterval <- max 1 x
+
     /// Reads the next frame of the context and updates the data of the content it corresponds to (if Ignore on that content is
     /// set to false). The parameter of this function will be set to the index (in the Content array of this file) of the content read.
     /// Returns false if there are no more frames in the container.
     abstract member NextFrame : contentIndex : int byref -> bool
 
+    /// Reads up to the given amount of frames, stopping early once at least the given amount of bytes of audio data has been read.
+    /// The frames read for each audio content are appended to the Block of that content, which is cleared at the start of the call
+    /// and becomes the Data of the content. Frames for ignored content are not counted. Batches only hold audio, so all other
+    /// content must be ignored, or InvalidOperationException is raised. Returns the amount of frames read, which will be zero if
+    /// there are no more frames in the context.
+    abstract member NextFrames : maxFrames : int * maxBytes : int -> int
+    default this.NextFrames (maxFrames, maxBytes) =
+        for item in content do
+            if not (item :? AudioContent) && not item.Ignore then
+                new InvalidOperationException ("Frames can only be read in batches when all content other than audio is ignored.") |> raise
+        for item in content do
+            match item with
+            | :? AudioContent as audio -> audio.Block.Clear ()
+            | _ -> ()
+        let mutable frames = 0
+        let mutable bytes = 0
+        let mutable index = 0
+        while frames < maxFrames && bytes < maxBytes && this.NextFrame (&index) do
+            match content.[index] with
+            | :? AudioContent as audio when not audio.Ignore ->
+                match audio.Data with
+                | Some data ->
+                    let size = int data.Size
+                    match data with
+                    | :? AudioFrame as frame ->
+                        audio.Block.Append (frame, frame.Time)
+                        frame.Return ()
+                    | data -> audio.Block.Append (data, nan)
+                    frames <- frames + 1
+                    bytes <- bytes + size
+                | None -> ()
+            | _ -> ()
+        for item in content do
+            match item with
+            | :? AudioContent as audio when audio.Block.Frames > 0 -> audio.Data <- audio.Block.DataOption
+            | _ -> ()
+        frames
+
+    /// Tries seeking the context so that the next frames read for the content at the given index begin at, or shortly before,
+    /// the given time in seconds. Returns false if the context does not support seeking or the seek failed.
+    abstract member Seek : contentIndex : int * time : float -> bool
+    default this.Seek (contentIndex, time) = false
+
+    /// Reads the next compressed packet of content that is not ignored into the given packet, without decoding it. Reading
+    /// packets and reading frames from the same context should not be mixed. Returns false if there are no more packets, or if
+    /// the context does not give packets.
+    abstract member NextPacket : packet : ContentPacket -> bool
+    default this.NextPacket packet = false
+
+/// Identifies the methods a decoder may use to decode on several threads.
+[<Flags>]
+type DecodeThreading =
+    | Single = 0
+    | Frame = 1
+    | Slice = 2
+    | Any = 3
+
+/// Contains parameters for decoding content from a container.
+type DecodeParameters = {
+
+    /// The maximum amount of frames to decode ahead of the reader on a background thread. If this is 0, frames are
+    /// decoded on the thread that reads them.
+    ReadAheadFrames : int
+
+    /// The maximum amount of time, in seconds, to decode ahead of the reader when reading ahead. If this is 0, only
+    /// ReadAheadFrames limits how far ahead decoding gets.
+    ReadAheadTime : float
+
+    /// Determines wether frames for ignored content are skipped by the context. If so, Context.NextFrame will never
+    /// return the index of ignored content. Otherwise, frames for ignored content that could not be discarded by the
+    /// container format are still returned, without data.
+    SkipIgnored : bool
+
+    /// The amount of threads each decoder may use. If this is 0, the amount is chosen based on the amount of processors
+    /// on the machine. Setting this explicitly gives deterministic decoder behavior, for example when benchmarking.
+    DecodeThreads : int
+
+    /// The methods decoders may use to decode on several threads. Decoders that do not support any of these methods
+    /// will decode on a single thread.
+    DecodeThreading : DecodeThreading
+
+    /// The maximum amount of bytes to read when determining the container format and its content. If this is 0, the
+    /// container's default is used.
+    ProbeSize : int
+
+    /// The maximum amount of time, in seconds, of content to read when determining stream information. If this is 0,
+    /// the container's default is used.
+    AnalyzeDuration : float
+
+    /// The cache used to store probe results for local files, so that reopening an unchanged file skips probing.
+    ProbeCache : ProbeCache option
+
+    /// Determines wether video is decoded on the GPU when possible. Video that can not be decoded in hardware is decoded
+    /// in software, and VideoContent.Decoder tells which is used.
+    HardwareVideo : bool
+
+    /// The index used to store seek tables for local files. If given, contexts record the positions of audio packets as
+    /// they are read, and use them to seek audio content to the exact sample, scanning forward from the last known
+    /// position when seeking past the indexed part of a file.
+    SeekIndex : SeekIndex option
+
+    /// The cache used to store decoded audio for local files. If given, audio content read from start to end is stored
+    /// in the cache, and AudioContent.TryGetCached gives the stored samples when reopening an unchanged file.
+    DecodeCache : DecodeCache option
+
+    /// The amount of samples in each block of level 0 of the summaries built for audio content while decoding. This should
+    /// be a power of two. If this is 0, no summaries are built. See AudioContent.Summary.
+    SummaryBlockSize : int
+
+    } with
+
+    /// Gets the amount of threads decoders should use for these parameters.
+    member this.ThreadCount =
+        if this.DecodeThreading = DecodeThreading.Single then 1
+        elif this.DecodeThreads > 0 then this.DecodeThreads
+        else min 16 Environment.ProcessorCount
+
+    /// The default decoding parameters.
+    static member Default = {
+            ReadAheadFrames = 0
+            ReadAheadTime = 0.0
+            SkipIgnored = false
+            DecodeThreads = 0
+            DecodeThreading = DecodeThreading.Any
+            ProbeSize = 0
+            AnalyzeDuration = 0.0
+            ProbeCache = None
+            HardwareVideo = false
+            SeekIndex = None
+            DecodeCache = None
+            SummaryBlockSize = 0
+        }
+
+/// Identifies the kind of content in a stream.
+type MediaStreamKind =
+    | Audio = 0
+    | Video = 1
+    | Other = 2
+
+/// Describes a stream of a media file as given in the header of its container.
+type MediaStreamInfo = {
+
+    /// The kind of content in the stream.
+    Kind : MediaStreamKind
+
+    /// The short name of the codec of the stream, or null if it is not known.
+    Codec : string
+
+    /// The duration of the stream in seconds, or NaN if it is not known.
+    Duration : float
+
+    /// The bit rate of the stream in bits per second, or 0 if it is not known.
+    BitRate : int64
+
+    /// The sample rate of audio streams, or 0 if it is not given in the header.
+    SampleRate : int
+
+    /// The amount of channels in audio streams, or 0 if it is not given in the header.
+    Channels : int
+
+    /// The estimated amount of samples for each channel in audio streams, or -1 if it is not known.
+    SampleCount : int64
+
+    /// The width of video streams in pixels, or 0 if it is not given in the header.
+    Width : int
+
+    /// The height of video streams in pixels, or 0 if it is not given in the header.
+    Height : int
+
+    /// The frame rate of video streams, or 0.0 if it is not known.
+    FrameRate : float
+
+    /// The metadata tags of the stream.
+    Tags : IDictionary<string, string>
+
+    }
+
+/// Describes a media file as given in the header of its container, without opening decoders for its content. Values taken
+/// from the header are estimates and may differ from what decoding gives.
+type MediaInfo = {
+
+    /// The name of the container format of the file.
+    Container : string
+
+    /// The duration of the file in seconds, or NaN if it is not known.
+    Duration : float
+
+    /// The total bit rate of the file in bits per second, or 0 if it is not known.
+    BitRate : int64
+
+    /// The streams of the file.
+    Streams : MediaStreamInfo[]
+
+    /// The metadata tags of the file.
+    Tags : IDictionary<string, string>
+
+    }
+
 /// Describes a multimedia container format that can store content within a stream.
 [<AbstractClass>]
 type Container (name : string) =
     static let mutable registry = new Registry<Container> ()
     static let mutable loadRegistry = new Registry<LoadContainerAction> ()
+    static let mutable findRegistry = new Registry<FindContainerAction> ()
+    static let mutable infoRegistry = new Registry<ReadInfoAction> ()
 
     /// Registers a new container format.
     static member Register (container : Container) = registry.Add container
 
+    /// Registers a new find action to be used when looking up container formats that have not been registered
+    /// directly. The given action will be given priority over all current find actions.
+    static member RegisterFind (find : FindContainerAction) = findRegistry.Add find
+
+    /// Tries finding a container format with the given name, first among registered container formats, then
+    /// using the registered find actions. If no such format is known, None is returned.
+    static member Find (name : string) =
+        match registry |> Seq.tryFind (fun container -> container.Name = name) with
+        | Some container -> Some container
+        | None -> findRegistry |> Seq.tryPick (fun find -> find.Invoke (name, null))
+
+    /// Tries finding a container format for files with the given extension (without a leading period) using the
+    /// registered find actions. If no such format is known, None is returned.
+    static member FindByExtension (extension : string) =
+        findRegistry |> Seq.tryPick (fun find -> find.Invoke (null, extension))
+
     /// Registers a new load action to be used when loading containers. The given action
     /// will be given priority over all current load actions.
     static member RegisterLoad (load : LoadContainerAction) = loadRegistry.Add load
 
-    /// Gets all registered container formats.
+    /// Gets all directly-registered container formats. Formats provided by find actions are not included.
     static member Available : seq<Container> = seq(registry)
 
+    /// Tries loading a context from data (with an optionally specified filename) using a previously-registered load
+    /// action. If no action is able to load the data, None is returned. 
+    static member Load (data : Data<byte> exclusive, filename : string, parameters : DecodeParameters) = 
+        loadRegistry |> Seq.tryPick (fun load -> load.Invoke (data, filename, parameters))
+
     /// Tries loading a context from data (with an optionally specified filename) using a previously-registered load
     /// action. If no action is able to load the data, None is returned. 
     static member Load (data : Data<byte> exclusive, filename : string) = 
-        loadRegistry |> Seq.tryPick (fun load -> load.Invoke (data, filename))
+        Container.Load (data, filename, DecodeParameters.Default)
+
+    /// Tries loading a context from the given file using a previously-registered load
+    /// action. If no action is able to load the data, None is returned. 
+    static member Load (file : Path, parameters : DecodeParameters) = 
+        Container.Load (Data.file file, file.Name, parameters)
 
     /// Tries loading a context from the given file using a previously-registered load
     /// action. If no action is able to load the data, None is returned. 
     static member Load (file : Path) = 
-        Container.Load (Data.file file, file.Name)
+        Container.Load (file, DecodeParameters.Default)
 
-    /// Gets the user-friendly name of this container format.
-    member this.Name = name
+    /// Registers a new action to be used when reading media information. The given action will be given priority over all
+    /// current info actions.
+    static member RegisterInfo (info : ReadInfoAction) = infoRegistry.Add info
 
-    /// Tries decoding content from the given input stream using this format.
-    abstract member Decode : stream : Stream<byte> exclusive -> Context exclusive option
+    /// Tries reading media information from the header of the container in the given data (with an optionally specified
+    /// filename) using a previously-registered info action. This is much faster than loading a context, as decoders are
+    /// not opened and only the header is read. The data is released once done. If no action is able to read the data, None
+    /// is returned.
+    static member ReadInfo (data : Data<byte> exclusive, filename : string, parameters : DecodeParameters) =
+        try infoRegistry |> Seq.tryPick (fun info -> info.Invoke (data.Object, filename, parameters))
+        finally data.Release.Invoke ()
 
-    /// Tries encoding content to the given stream using this format.
-    abstract member Encode : context : Context exclusive -> Stream<byte> exclusive option
+    /// Tries reading media information from the header of the container of the given file. See ReadInfo.
+    static member ReadInfo (file : Path, parameters : DecodeParameters) =
+        Container.ReadInfo (Data.file file, file.Name, parameters)
 
-/// An action that loads a context from data (with an optionally-specified filename) using an unspecified container format. If
-/// the action can not load the container, None is returned.
-and LoadContainerAction = delegate of data : Data<byte> exclusive * filename : string -> (Container * Context exclusive) option
+    /// Tries reading media information from the header of the container of the given file. See ReadInfo.
+    static member ReadInfo (file : Path) = Container.ReadInfo (file, DecodeParameters.Default)
 
+    /// Loads contexts for many files in parallel on up to the given amount of worker threads, calling the given callback
+    /// with each file and its result as soon as it is loaded. Callbacks may be called on any worker thread and in any order,
+    /// and files that can not be read or have no known format give None. Returns a task that completes once all files have
+    /// been loaded. Any other exception raised while loading a file or by the callback does not stop the remaining files, but
+    /// faults the returned task once they are done. Load actions must allow being called from several threads at once.
+    static member LoadBatch (files : seq<Path>, parameters : DecodeParameters, workers : int, completed : Path -> (Container * Context exclusive) option -> unit) =
+        let queue = new Queue<Path> (files)
+        let errors = new List<exn> ()
+        let next () = lock queue (fun () -> if queue.Count > 0 then Some (queue.Dequeue ()) else None)
+        let work () =
+            let mutable file = next ()
+            while file.IsSome do
+                try
+                    let result =
+                        try Container.Load (file.Value, parameters)
+                        with
+                        | :? IO.IOException | :? UnauthorizedAccessException -> None
+                    completed file.Value result
+                with error -> lock errors (fun () -> errors.Add error)
+                file <- next ()
+        let finish (tasks : Task[]) =
+            for task in tasks do
+                if task.IsFaulted then lock errors (fun () -> errors.AddRange task.Exception.InnerExceptions)
+            if errors.Count > 0 then new AggregateException (errors) |> raise
+        let tasks = Array.init (max 1 (min workers queue.Count)) (fun _ -> Task.Factory.StartNew (Action work, TaskCreationOptions.LongRunning))
+        Task.Factory.ContinueWhenAll (tasks, Action<Task[]> finish)
 
-/// Identifies an audio format for a sample of a single channel.
-type AudioFormat =
-    | PCM8 = 0
-    | PCM16 = 1
-    | PCM32 = 2
-    | Float = 3
-    | Double = 4
+    /// Loads contexts for many files in parallel, using a worker thread for each processor. See LoadBatch.
+    static member LoadBatch (files : seq<Path>, parameters : DecodeParameters, completed : Path -> (Container * Context exclusive) option -> unit) =
+        Container.LoadBatch (files, parameters, Environment.ProcessorCount, completed)
 
-/// An interface to audio content in a container.
-type AudioContent (sampleRate : float, channels : int, format : AudioFormat) =
-    inherit Content ()
-    let mutable data : Data<byte> option = None
+    /// Gets the user-friendly name of this container format.
+    member this.Name = name
 
-    /// Determines the amount of bytes in a sample of the given audio format.
-    static member BytesPerSample (format : AudioFormat) =
-        match format with
-        | AudioFormat.PCM8 -> 1
-        | AudioFormat.PCM16 -> 2
-        | AudioFormat.PCM32 -> 4
-        | AudioFormat.Float -> 4
-        | AudioFormat.Double -> 8
-        | x -> 0
+    /// Tries decoding content from the given input stream using this format.
+    abstract member Decode : stream : Stream<byte> exclusive * parameters : DecodeParameters -> Context exclusive option
 
-    /// Gets the sample rate, in samples per second, for this audio content.
-    member this.SampleRate = sampleRate
+    /// Tries decoding content from the given input stream using this format with the default parameters.
+    member this.Decode (stream : Stream<byte> exclusive) = this.Decode (stream, DecodeParameters.Default)
 
-    /// Gets the amount of channels in this audio content. Multichannel audio content will have
-    /// sample data for channels interleaved in the data array.
-    member this.Channels = channels
+    /// Tries encoding content to the given stream using this format.
+    abstract member Encode : context : Context exclusive -> Stream<byte> exclusive option
 
-    /// Gets the format for this audio content.
-    member this.Format = format
+    /// Tries writing the compressed packets of the given context to a stream using this format, without decoding them. Content
+    /// that this format can not take packets for is ignored. Returns None if the content can not be written, or if this format
+    /// does not support remuxing.
+    abstract member Remux : context : Context exclusive -> Stream<byte> exclusive option
+    default this.Remux context = None
 
-    /// Gets or sets the audio data for the current frame. This should be updated when a call to
-    /// Context.NextFrame returns a content index for this audio content.
-    member this.Data
-        with get () = data
-        and set x = data <- x
\ No newline at end of file
+/// An action that loads a context from data (with an optionally-specified filename) using an unspecified container format and
+/// the given decoding parameters. If the action can not load the container, None is returned.
+and LoadContainerAction = delegate of data : Data<byte> exclusive * filename : string * parameters : DecodeParameters -> (Container * Context exclusive) option
+
+/// An action that reads media information from the header of a container in data (with an optionally-specified filename).
+/// The data is only used while the action runs. If the action can not read the container, None is returned.
+and ReadInfoAction = delegate of data : Data<byte> * filename : string * parameters : DecodeParameters -> MediaInfo option
+
+/// An action that finds a container format by either name or file extension (exactly one of which is given). If the action
+/// does not know of a matching container format, None is returned.
+and FindContainerAction = delegate of name : string * extension : string -> Container option
\ No newline at end of file
@@ -163,22 +163,48 @@ type CooleyTukeyDFT (size : int, unit : DFT) =
         this.InitializeUnitsComplex (input, output)
         this.ApplyRounds (output)
 
+/// An action that tries creating a DFT method of the given size, returning None if the size is not supported.
+type CreateDFTAction = delegate of size : int -> DFT option
+
 /// Contains functions and methods related to DFT's.
 [<CompilationRepresentation(CompilationRepresentationFlags.ModuleSuffix)>]
 module DFT =
 
-    /// Creates a DFT method for a DFT of the given size.
-    let create size =
+    /// Creates a managed DFT method for a DFT of the given size.
+    let createManaged size =
         match size with
         | 4 -> QuickDFT.Instance :> DFT
         | x when ispow2 (uint32 x) && x > 4 -> new CooleyTukeyDFT (size) :> DFT
         | _ -> new NotImplementedException () |> raise
 
-    /// A cache containing DFT's of various sizes.
-    let cache = new AutoCache<int, DFT> (create) :> Cache<int, DFT>
+    /// The registered actions for creating DFT methods, in order of priority.
+    let private providers = new Registry<CreateDFTAction> ()
 
-    /// Gets a DFT method for a DFT of the given size.
-    let get size = cache.[size]
+    /// Creates a DFT method for a DFT of the given size, using the registered create actions before falling back to a
+    /// managed method.
+    let create size =
+        match lock providers (fun () -> providers |> Seq.tryPick (fun provider -> provider.Invoke size)) with
+        | Some dft -> dft
+        | None -> createManaged size
+
+    /// A cache containing DFT's of various sizes. The cache is replaced whenever the registered create actions change.
+    let mutable cache = new AutoCache<int, DFT> (create) :> Cache<int, DFT>
+
+    /// Registers an action for creating DFT methods, such as a native implementation, to be used by get and the compute
+    /// functions. The given action will be given priority over all current actions. Returns a retract action to later
+    /// remove it.
+    let register (provider : CreateDFTAction) =
+        lock providers (fun () ->
+            let retract = providers.Add provider
+            cache <- new AutoCache<int, DFT> (create) :> Cache<int, DFT>
+            Action.Custom (fun () ->
+                lock providers (fun () ->
+                    retract.Invoke ()
+                    cache <- new AutoCache<int, DFT> (create) :> Cache<int, DFT>)))
+
+    /// Gets a DFT method for a DFT of the given size. This may be called from any thread, and the returned method may be
+    /// used by several threads at once.
+    let get size = lock providers (fun () -> cache.[size])
 
     /// Computes a DFT of the given size on real input.
     let computeReal input output size = (get size).ComputeReal (input, output)
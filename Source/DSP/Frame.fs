@@ -31,23 +31,67 @@ type DiscreteKernel = {
     /// the spectrum.
     Offset : int
 
+    /// The index of the first sample of the window that is not negligible. Samples before it are taken to be zero.
+    First : int
+
+    /// The amount of samples of the window, starting at First, that are not negligible.
+    Count : int
+
+    /// The index in the spectrum of the first sample of the window that is not negligible.
+    Start : int
+
+    /// The amount of samples of the window, starting at First, that come before the window wraps around the end of
+    /// the spectrum.
+    Split : int
+
     }
 
 /// Contains functions and methods related to frames and kernels.
 module Frame =
 
+    /// The magnitude, relative to the largest sample, below which samples at the edges of a discrete kernel are
+    /// trimmed.
+    let kernelThreshold = 1.0e-12
+
     /// Creates a discrete form of the given kernel for a spectrum of the given size. The kernel will be normalized so
     /// that the total of all values is 1.0.
     let createDiscreteKernel spectrumSize kernelSize (kernel : Kernel) =
         let windowSize = float spectrumSize * kernel.Bandwidth
         let offset = int (float spectrumSize * kernel.Center) - kernelSize / 2
         let offset = (offset + spectrumSize) % spectrumSize
-        { Window = Window.create kernel.Window windowSize kernelSize; Offset = offset }
+        let window = Window.create kernel.Window windowSize kernelSize
+
+        // Trim negligible samples from both ends of the window.
+        let threshold = (window |> Array.fold (fun m x -> max m (abs x)) 0.0) * kernelThreshold
+        let mutable first = 0
+        while first < kernelSize && abs window.[first] <= threshold do
+            first <- first + 1
+        let mutable last = kernelSize
+        while last > first && abs window.[last - 1] <= threshold do
+            last <- last - 1
+        let start = (offset + first) % spectrumSize
+        let count = last - first
+        { Window = window; Offset = offset; First = first; Count = count; Start = start; Split = min count (spectrumSize - start) }
 
     /// Applies a discrete kernel to a spectrum and reads the windowed spectral content to the given output buffer.
     let applyDiscreteKernel (spectrumBuffer : Buffer<Complex>) spectrumSize (kernel : DiscreteKernel) (outputBuffer : Buffer<Complex>) =
         let mutable outputBuffer = outputBuffer
         let window = kernel.Window
-        let offset = kernel.Offset
-        for t = 0 to window.Length - 1 do
-            outputBuffer.[t] <- spectrumBuffer.[(t + offset) % spectrumSize] * window.[t]
\ No newline at end of file
+        let first = kernel.First
+        let last = first + kernel.Count
+        for t = 0 to first - 1 do
+            outputBuffer.[t] <- Complex.Zero
+        for t = last to window.Length - 1 do
+            outputBuffer.[t] <- Complex.Zero
+
+        // Apply the window up to where it wraps around the spectrum, then from the start of the spectrum.
+        let source = spectrumBuffer.Advance (kernel.Start - first)
+        for t = first to first + kernel.Split - 1 do
+            outputBuffer.[t] <- source.[t] * window.[t]
+        let mutable t = first + kernel.Split
+        while t < last do
+            let source = spectrumBuffer.Advance (-t)
+            let stop = min last (t + spectrumSize)
+            while t < stop do
+                outputBuffer.[t] <- source.[t] * window.[t]
+                t <- t + 1
@@ -2,6 +2,8 @@
 
 open System
 open System.IO
+open System.IO.MemoryMappedFiles
+open Microsoft.FSharp.NativeInterop
 open MD
 open MD.Util
 
@@ -200,6 +202,42 @@ type IOData (source : Stream) =
         source.Position <- int64 index
         new IOStream (source) :> Stream<byte> |> Exclusive.make
 
+/// Data from a read-only memory-mapped view of a file.
+[<Sealed>]
+type MappedData (file : MemoryMappedFile, view : MemoryMappedViewAccessor, size : uint64, name : string) =
+    inherit Data<byte> (1)
+    let handle = view.SafeMemoryMappedViewHandle
+    let buffer =
+        let mutable pointer = NativePtr.ofNativeInt<byte> 0n
+        handle.AcquirePointer (&pointer)
+        Buffer<byte>.FromPointer pointer
+    let mutable disposed = false
+
+    /// Maps the file of the given stream. The stream is left open and must outlive the mapped data.
+    static member FromStream (stream : FileStream) =
+        let size = uint64 stream.Length
+        let file = MemoryMappedFile.CreateFromFile (stream, null, 0L, MemoryMappedFileAccess.Read, null, HandleInheritability.None, true)
+        let view = file.CreateViewAccessor (0L, 0L, MemoryMappedFileAccess.Read)
+        new MappedData (file, view, size, stream.Name)
+
+    /// Gets the buffer for the mapped view of this data.
+    member this.Buffer = buffer
+
+    /// Gets the name of the mapped file, or null if it is not known.
+    member this.Name = name
+
+    override this.Size = size
+    override this.Read (index, array, offset, size) = Buffer.copyba (new Buffer<byte> (buffer.Start + nativeint index, 1u)) array offset size
+    override this.Lock (index, size) = Stream.buffer (new Buffer<byte> (buffer.Start + nativeint index, 1u)) |> Exclusive.make
+
+    interface IDisposable with
+        member this.Dispose () =
+            if not disposed then
+                disposed <- true
+                handle.ReleasePointer ()
+                view.Dispose ()
+                file.Dispose ()
+
 /// Contains functions for constructing and manipulating data.
 module Data =
 
@@ -211,8 +249,11 @@ module Data =
     /// changes to the buffer will be reflected in the data.
     let array array offset size = new ArrayData<'a> (array, offset, size) :> Data<'a>
 
-    /// Constructs data from the remaining items in the given stream.
-    let make chunkSize (stream : Stream<'a> exclusive) =
+    /// Constructs data from the remaining items in the given stream, which is expected to have about the given amount of
+    /// items. Up to that amount is read into a single array, and any items past it are read in chunks of the given size.
+    /// The array starts at a few megabytes and doubles as it fills, so an overestimated size does not allocate memory that
+    /// is never read into. If the expected size is not known, it may be given as 0 or less.
+    let makeSized (sizeHint : int64) chunkSize (stream : Stream<'a> exclusive) =
         let data = new ChunkData<'a> (1)
         let streamobj = stream.Object
         let rec readChunk () =
@@ -220,15 +261,47 @@ module Data =
             let size = streamobj.Read (array, 0, chunkSize)
             data.Append (new ArrayData<'a> (array, 0, size) :> Data<'a>)
             if size = chunkSize then readChunk ()
-        readChunk ()
+        if sizeHint > 0L then
+            let limit = int (min sizeHint (int64 Int32.MaxValue))
+            let initial = max chunkSize ((4 <<< 20) / max 1 sizeof<'a>)
+            let mutable array = Array.zeroCreate (min limit initial)
+            let mutable size = 0
+            let mutable read = 1
+            while read > 0 && (size < array.Length || array.Length < limit) do
+                if size = array.Length then
+                    let grown = Array.zeroCreate (int (min (int64 array.Length * 2L) (int64 limit)))
+                    Array.blit array 0 grown 0 size
+                    array <- grown
+                read <- streamobj.Read (array, size, array.Length - size)
+                size <- size + read
+            data.Append (new ArrayData<'a> (array, 0, size) :> Data<'a>)
+            if size = limit then readChunk ()
+        else readChunk ()
         stream.Release.Invoke ()
         data :> Data<'a>
 
+    /// Constructs data from the remaining items in the given stream.
+    let make chunkSize (stream : Stream<'a> exclusive) = makeSized 0L chunkSize stream
+
     /// Constructs data for the file at the given path.
     let file (path : MD.Path) = 
         let fs = new FileStream (path.Source, FileMode.Open)
         fs |> Exclusive.dispose |> Exclusive.map (fun fs -> new IOData (fs) :> Data<byte>)
 
+    /// Constructs data for a read-only memory-mapped view of the file at the given path. The file must not be empty.
+    let mapFile (path : MD.Path) =
+        let fs = new FileStream (path.Source, FileMode.Open, FileAccess.Read, FileShare.Read)
+        try
+            let data = MappedData.FromStream fs
+            let release () =
+                (data :> IDisposable).Dispose ()
+                fs.Dispose ()
+            Exclusive.custom release (data :> Data<byte>)
+        with
+        | _ ->
+            fs.Dispose ()
+            reraise ()
+
     /// Constructs data whose source is an IO stream.
     let io (source : System.IO.Stream) = new IOData (source) :> Data<byte>
 
@@ -0,0 +1,169 @@
+﻿namespace MD
+
+open System
+open System.Runtime.InteropServices
+
+/// Writes decoded samples of a content to a decode cache. Samples only become available from the cache once the writer is
+/// committed, which should be done once all samples of the content have been written.
+[<Sealed; AllowNullLiteral>]
+type DecodeCacheWriter (file : Path, temporary : Path, commit : unit -> unit) =
+    let stream = new IO.FileStream (temporary.Source, IO.FileMode.Create, IO.FileAccess.Write, IO.FileShare.None)
+    let mutable transfer : byte[] = Array.zeroCreate 0
+    let mutable closed = false
+
+    /// Gets the file the samples will be stored in once committed.
+    member this.File = file
+
+    /// Appends samples, in native memory, to the cache entry.
+    member this.Write (data : nativeint, size : int) =
+        if transfer.Length < size then transfer <- Array.zeroCreate size
+        Marshal.Copy (data, transfer, 0, size)
+        stream.Write (transfer, 0, size)
+
+    /// Stores the written samples in the cache, replacing any existing entry for the same content. The written samples are
+    /// discarded if they can not be stored.
+    member this.Commit () =
+        if not closed then
+            closed <- true
+            let size = stream.Length
+            stream.Dispose ()
+            if size > 0L then
+                try
+                    if file.FileExists then IO.File.Delete file.Source
+                    IO.File.Move (temporary.Source, file.Source)
+                with _ ->
+                    if temporary.FileExists then IO.File.Delete temporary.Source
+                    reraise ()
+                commit ()
+            else IO.File.Delete temporary.Source
+
+    /// Discards the written samples.
+    member this.Abort () =
+        if not closed then
+            closed <- true
+            stream.Dispose ()
+            IO.File.Delete temporary.Source
+
+    interface IDisposable with
+        member this.Dispose () = this.Abort ()
+
+/// A persistent store of decoded audio samples for local files, kept in a directory with one raw sample file for each content
+/// and output format, along with a summary of each content. Entries are keyed by file path, size and modification time, so entries for changed files are never
+/// used. Once the entries exceed the size budget, the least recently used entries are deleted.
+[<Sealed>]
+type DecodeCache (directory : Path, budget : int64) =
+
+    /// Gets the directory this cache is stored in.
+    member this.Directory = directory
+
+    /// Gets the maximum total size, in bytes, of the entries in this cache.
+    member this.Budget = budget
+
+    /// Gets the path of the entry for the given content of the file with the given name, with the given output settings.
+    member this.EntryFile (filename : string, contentIndex : int, format : AudioFormat, sampleRate : int, channels : int) =
+        let info = new IO.FileInfo (filename)
+        let key = sprintf "%s|%d|%d|%d|%d|%d|%d" (info.FullName.ToLowerInvariant ()) info.Length info.LastWriteTimeUtc.Ticks contentIndex (int format) sampleRate channels
+        directory + sprintf "%016X.pcm" (Util.hashString key)
+
+    /// Gets the path of the stored summary for the given content of the file with the given name.
+    member this.SummaryFile (filename : string, contentIndex : int) =
+        let info = new IO.FileInfo (filename)
+        let key = sprintf "%s|%d|%d|%d|summary" (info.FullName.ToLowerInvariant ()) info.Length info.LastWriteTimeUtc.Ticks contentIndex
+        directory + sprintf "%016X.sum" (Util.hashString key)
+
+    /// Tries loading the stored summary for the given content of the file with the given name.
+    member this.TryLoadSummary (filename : string, contentIndex : int) =
+        let file = this.SummaryFile (filename, contentIndex)
+        if not file.FileExists then None
+        else
+            try
+                IO.File.SetLastAccessTimeUtc (file.Source, DateTime.UtcNow)
+                use reader = new IO.BinaryReader (IO.File.OpenRead file.Source)
+                AudioSummary.Read reader
+            with
+            | :? IO.IOException | :? UnauthorizedAccessException -> None
+
+    /// Stores a summary for the given content of the file with the given name. Returns false if it could not be stored.
+    member this.SaveSummary (filename : string, contentIndex : int, summary : AudioSummary) =
+        try
+            directory.MakeDirectory () |> ignore
+            use writer = new IO.BinaryWriter (IO.File.Create (this.SummaryFile (filename, contentIndex)).Source)
+            summary.Write writer
+            true
+        with
+        | :? IO.IOException | :? UnauthorizedAccessException -> false
+
+    /// Tries opening the stored samples for the given content of the file with the given name, with the given output settings.
+    /// Samples are interleaved and memory-mapped from the cache.
+    member this.TryOpen (filename : string, contentIndex : int, format : AudioFormat, sampleRate : int, channels : int) =
+        let file = this.EntryFile (filename, contentIndex, format, sampleRate, channels)
+        if not file.FileExists then None
+        else
+            try
+                let stream = new IO.FileStream (file.Source, IO.FileMode.Open, IO.FileAccess.Read, IO.FileShare.Read)
+                try
+                    IO.File.SetLastAccessTimeUtc (file.Source, DateTime.UtcNow)
+                    let mapped = MappedData.FromStream stream
+                    let release () =
+                        (mapped :> IDisposable).Dispose ()
+                        stream.Dispose ()
+                    Some (mapped :> Data<byte> |> Exclusive.custom release)
+                with _ ->
+                    stream.Dispose ()
+                    reraise ()
+            with
+            | :? IO.IOException | :? UnauthorizedAccessException -> None
+
+    /// Creates a writer for the entry of the given content of the file with the given name, with the given output settings.
+    /// Returns null if the entry can not be written.
+    member this.Create (filename : string, contentIndex : int, format : AudioFormat, sampleRate : int, channels : int) =
+        let file = this.EntryFile (filename, contentIndex, format, sampleRate, channels)
+        let temporary = new Path (file.Source + "." + Guid.NewGuid().ToString ("N") + ".tmp")
+        try
+            directory.MakeDirectory () |> ignore
+            new DecodeCacheWriter (file, temporary, this.Trim)
+        with
+        | :? IO.IOException | :? UnauthorizedAccessException -> null
+
+    /// Deletes the least recently used entries until the entries of this cache fit within its budget.
+    member this.Trim () =
+        try
+            let info = new IO.DirectoryInfo (directory.Source)
+            let entries = Array.append (info.GetFiles "*.pcm") (info.GetFiles "*.sum") |> Array.sortBy (fun x -> x.LastAccessTimeUtc)
+            let mutable total = entries |> Array.sumBy (fun x -> x.Length)
+            let mutable index = 0
+            while total > budget && index < entries.Length do
+                let entry = entries.[index]
+                try
+                    entry.Delete ()
+                    total <- total - entry.Length
+                with
+                | :? IO.IOException -> ()
+                index <- index + 1
+        with
+        | :? IO.IOException | :? UnauthorizedAccessException -> ()
+
+/// The source of audio content in a decode cache: the local file and index of the content.
+[<Sealed; AllowNullLiteral>]
+type DecodeCacheSource (cache : DecodeCache, filename : string, contentIndex : int) =
+
+    /// Gets the cache the content is stored in.
+    member this.Cache = cache
+
+    /// Gets the name of the local file the content is read from.
+    member this.FileName = filename
+
+    /// Gets the index of the content in its context.
+    member this.ContentIndex = contentIndex
+
+    /// Tries opening the stored samples of the content with the given output settings.
+    member this.TryOpen (format, sampleRate, channels) = cache.TryOpen (filename, contentIndex, format, sampleRate, channels)
+
+    /// Creates a writer for the samples of the content with the given output settings, or returns null if it can not be written.
+    member this.Create (format, sampleRate, channels) = cache.Create (filename, contentIndex, format, sampleRate, channels)
+
+    /// Tries loading the stored summary of the content.
+    member this.TryLoadSummary () = cache.TryLoadSummary (filename, contentIndex)
+
+    /// Stores a summary of the content. Returns false if it could not be stored.
+    member this.SaveSummary (summary : AudioSummary) = cache.SaveSummary (filename, contentIndex, summary)
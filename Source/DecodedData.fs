@@ -0,0 +1,182 @@
+﻿namespace MD
+
+open System
+open System.Collections.Generic
+
+/// Decoded audio for a single content of a context, given as random-access data without decoding the entire content up front.
+/// The data is divided into blocks of a fixed amount of samples, and reading decodes only the blocks that cover the requested
+/// range, seeking the context as needed. Recently read blocks are kept in a bounded cache, and sequential reads decode each block
+/// once without seeking. Samples are interleaved, in the output format, sample rate and channels of the content at the time this
+/// data is created. The size of this data is based on the estimated sample count of the content; samples past the end of the
+/// decoded content read as zero. If the samples are stored in a decode cache, they are read from the cache instead, and the
+/// content is never decoded. Reading a block that can only be reached by seeking raises IOException if the context fails to
+/// seek, and the block is not kept. This data owns the given context, and all other content of the context is ignored.
+[<Sealed>]
+type DecodedAudioData (context : Context exclusive, contentIndex : int, blockSamples : int, maxBlocks : int) =
+    inherit Data<byte> (1)
+    let source = context.Object
+    let audio = source.Content.[contentIndex] :?> AudioContent
+    do
+        for content in source.Content do
+            content.Ignore <- true
+        audio.Ignore <- false
+        audio.Planar <- false
+    let sampleSize = audio.OutputChannels * AudioContent.BytesPerSample audio.OutputFormat
+    let sampleRate = audio.OutputSampleRate
+    let blockSize = blockSamples * sampleSize
+    let sampleCount =
+        if audio.SampleCount > 0L then int64 (float audio.SampleCount * sampleRate / audio.SampleRate)
+        else 0L
+    let cached = audio.TryGetCached ()
+    let mutable transfer : byte[] = Array.zeroCreate 0
+
+    // The block that the frame being decoded continues into, and the sample at which the next decoded frame begins, or -1 if
+    // the position of the context is not known.
+    let mutable pending : byte[] = null
+    let mutable pendingBlock = -1L
+    let mutable position = -1L
+    let mutable finished = false
+    let mutable disposed = false
+
+    /// Reads the next frame of the content into the transfer buffer, returning its time and size in bytes.
+    let rec next () =
+        let mutable index = 0
+        if not (source.NextFrame (&index)) then None
+        elif index <> contentIndex then next ()
+        else
+            match audio.Data with
+            | Some data ->
+                let size = int data.Size
+                if transfer.Length < size then transfer <- Array.zeroCreate size
+                data.Read (0UL, transfer, 0, size)
+                match data with
+                | :? AudioFrame as frame ->
+                    let time = frame.Time
+                    frame.Return ()
+                    Some (time, size)
+                | _ -> Some (nan, size)
+            | None -> next ()
+
+    /// Seeks the context to, or before, the given sample and reads the first frame after the seek into the transfer buffer,
+    /// returning its size in bytes. If the context lands after the sample, it is seeked further back and tried again. If the
+    /// seek fails, decoding continues forward from the current position when it is before the sample, and otherwise the
+    /// sample can not be reached and IOException is raised.
+    let rec seek (sample : int64) (back : float) =
+        let time = max 0.0 (float sample / sampleRate - back)
+        let current = position
+        let ended = finished
+        finished <- false
+        position <- -1L
+        if not (source.Seek (contentIndex, time)) then
+            if current >= 0L && current <= sample then
+                position <- current
+                finished <- ended
+                None
+            else new IO.IOException (sprintf "The content could not be seeked to sample %d." sample) |> raise
+        else
+            match next () with
+            | Some (frameTime, size) ->
+                let first = int64 (Math.Round ((if Double.IsNaN frameTime then time else frameTime) * sampleRate))
+                if first > sample && time > 0.0 && back < 8.0 then seek sample (if back = 0.0 then 0.5 else back * 2.0)
+                else
+                    position <- first
+                    Some size
+            | None ->
+                finished <- true
+                None
+
+    /// Copies the samples of the transfer buffer, which begin at the given sample, that are within the given block.
+    let copy (target : byte[]) (targetStart : int64) (sourceStart : int64) (samples : int64) =
+        let first = max targetStart sourceStart
+        let last = min (targetStart + int64 blockSamples) (sourceStart + samples)
+        if last > first then
+            Array.Copy (transfer, int (first - sourceStart) * sampleSize, target, int (first - targetStart) * sampleSize, int (last - first) * sampleSize)
+
+    /// Decodes the block with the given index.
+    let decode (block : int64) =
+        let start = block * int64 blockSamples
+        let stop = start + int64 blockSamples
+        let continued = pendingBlock = block
+        let target = if continued then pending else Array.zeroCreate blockSize
+        pending <- null
+        pendingBlock <- -1L
+
+        // Decode forward from the current position when it is at, or shortly before, the start of the block.
+        let ahead = position >= 0L && (if position > start then continued else start - position <= int64 blockSamples)
+        let mutable held = if ahead then None else seek start 0.0
+        while not finished && position >= 0L && position < stop do
+            let frame =
+                match held with
+                | Some size ->
+                    held <- None
+                    Some size
+                | None ->
+                    match next () with
+                    | Some (_, size) -> Some size
+                    | None ->
+                        finished <- true
+                        None
+            match frame with
+            | Some size ->
+                let samples = int64 (size / sampleSize)
+                copy target start position samples
+                if position + samples > stop then
+                    pending <- Array.zeroCreate blockSize
+                    pendingBlock <- block + 1L
+                    copy pending stop position samples
+                position <- position + samples
+            | None -> ()
+        target
+
+    let cache = new ManualCache<int64, byte[]> (decode, ignore)
+
+    /// Creates decoded data for the audio content with the given index, using blocks of about a second of audio and
+    /// caching up to a minute of decoded audio.
+    new (context : Context exclusive, contentIndex : int) =
+        let audio = context.Object.Content.[contentIndex] :?> AudioContent
+        let blockSamples = max 16384 (int audio.OutputSampleRate)
+        new DecodedAudioData (context, contentIndex, blockSamples, 60)
+
+    /// Gets the audio content this data is decoded from.
+    member this.Content = audio
+
+    /// Gets the amount of samples in each block of this data.
+    member this.BlockSamples = blockSamples
+
+    /// Gets the maximum amount of decoded blocks kept by this data.
+    member this.MaxBlocks = maxBlocks
+
+    /// Gets wether the samples of this data are read from a decode cache.
+    member this.Cached = cached.IsSome
+
+    override this.Size =
+        match cached with
+        | Some data -> data.Object.Size
+        | None -> uint64 (sampleCount * int64 sampleSize)
+
+    override this.Read (index, array, offset, size) =
+        match cached with
+        | Some data -> data.Object.Read (index, array, offset, size)
+        | None ->
+            lock cache (fun () ->
+                let mutable index = index
+                let mutable offset = offset
+                let mutable remaining = size
+                while remaining > 0 do
+                    let block = int64 (index / uint64 blockSize)
+                    let blockOffset = int (index % uint64 blockSize)
+                    let count = min remaining (blockSize - blockOffset)
+                    Array.Copy (cache.[block], blockOffset, array, offset, count)
+                    index <- index + uint64 count
+                    offset <- offset + count
+                    remaining <- remaining - count
+                if cache.Size > maxBlocks then cache.Collect (cache.Size - maxBlocks))
+
+    override this.Lock (index, size) = new DataStream<byte> (this, index) :> Stream<byte> |> Exclusive.make
+
+    interface IDisposable with
+        member this.Dispose () =
+            if not disposed then
+                disposed <- true
+                cached |> Option.iter (fun data -> data.Release.Invoke ())
+                context.Release.Invoke ()
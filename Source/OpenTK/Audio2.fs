@@ -41,11 +41,15 @@ type AudioOutput private (context : AudioContext) =
                     sources.Remove source |> ignore
             Monitor.Exit messages
 
-            // Update sources (keep track of buffers processed and amount of active sources).
+            // Update sources (keep track of buffers processed, amount of active sources, and the longest wait that keeps
+            // every active source from running out of queued samples).
             let mutable activecount = 0
             let mutable buffercount = 0
+            let mutable maxwait = 500
             for source in sources.Keys do
-                if source.Playing then activecount <- activecount + 1
+                if source.Playing then
+                    activecount <- activecount + 1
+                    maxwait <- min maxwait source.MaxWait
                 buffercount <- buffercount + source.Update ()
 
             // Adjust wait time
@@ -53,8 +57,8 @@ type AudioOutput private (context : AudioContext) =
             match (waittime, activecount, buffercount) with
             | (x, 0, _) -> -1
             | (-1, _, _) -> 0
-            | (x, _, 0) -> min 500 (x + 5)
-            | (x, _, _) -> max 0 (x - 1)
+            | (x, _, 0) -> min maxwait (x + 5)
+            | (x, _, _) -> min maxwait (max 0 (x - 1))
 
         // Clean up on exit
         for kvp in sources do
@@ -117,11 +121,32 @@ type AudioOutput private (context : AudioContext) =
 
     interface MD.UI.AudioOutput with
         member this.Begin p =
+
+            // Contexts can only decode to the format of their content or to floating-point samples.
+            let convertible =
+                match p.Input with
+                | ContextInput (context, index) ->
+                    let audio = context.Object.Content.[index] :?> AudioContent
+                    p.Format = audio.Format || p.Format = AudioFormat.Float || p.Format = AudioFormat.Double
+                | StreamInput _ -> true
             match alformat p.Channels p.Format with
-            | Some (format, bps) ->
+            | Some (format, bps) when convertible ->
+                // Have the content of a context decode directly to the output format.
+                match p.Input with
+                | ContextInput (context, index) ->
+                    let audio = context.Object.Content.[index] :?> AudioContent
+                    for content in context.Object.Content do
+                        content.Ignore <- true
+                    audio.Ignore <- false
+                    audio.OutputFormat <- p.Format
+                    audio.OutputSampleRate <- float p.SampleRate
+                    audio.OutputChannels <- p.Channels
+                    audio.Planar <- false
+                | StreamInput _ -> ()
+
                 // Create source
                 this.MakeCurrent ()
-                let source = new AudioOutputSource (p, format, bps, 4096 * 4, 4)
+                let source = new AudioOutputSource (p, format, bps)
 
                 // Register control callback for message queue.
                 let retract = p.Control.Register (fun x ->
@@ -137,47 +162,108 @@ type AudioOutput private (context : AudioContext) =
                 Monitor.Exit messages
                 wait.Set () |> ignore
 
-                Some { Position = source.Position } 
+                Some { Position = source.Position; Underruns = source.Underruns }
             | _ -> None
 
         member this.Finish () =
             wait.Set () |> ignore
             exit <- true
 
-/// An interface to an OpenAL audio output source.
-and private AudioOutputSource (parameters : AudioOutputSourceParameters, format : ALFormat, bytesPerSample : int, bufferSize : int,  bufferCount : int) =
-    let stream = parameters.Stream
-    let samplesPerBuffer = bufferSize / bytesPerSample
+/// An interface to an OpenAL audio output source. Samples are queued in OpenAL buffers until about the target latency of
+/// the source is queued. Stream input is read in buffers of a quarter of the target latency, while each decoded frame of
+/// context input is given to OpenAL directly as its own buffer.
+and private AudioOutputSource (parameters : AudioOutputSourceParameters, format : ALFormat, bytesPerSample : int) =
     let sampleRate = parameters.SampleRate
     let pitch = parameters.Pitch
     let volume = parameters.Volume
 
+    // The amount of samples to keep queued, which defaults to four buffers of 16384 bytes.
+    let targetSamples =
+        if parameters.Latency > 0.0 then max 256 (int (parameters.Latency * float sampleRate))
+        else 4 * 4096 * 4 / bytesPerSample
+    let bufferSize = max 1 (targetSamples / 4) * bytesPerSample
+    let mutable transfer = Array.create bufferSize 0uy
+
     let mutable startPosition = 0UL
     let mutable playing = false
+    let mutable finished = false
     let position = new ControlSignalFeed<uint64> (0UL)
-    let buffer = Array.create bufferSize 0uy
+    let underruns = new ControlSignalFeed<int> (0)
     let sid = AL.GenSource ()
 
-    /// Writes the next set of data from the stream into the OpenAL buffer with the given id. Returns false if there is no
-    /// more data to be written.
-    let write bid =
-        let readsize = stream.Object.Read (buffer, 0, bufferSize)
-        if readsize > 0 then
-            AL.BufferData (bid, format, buffer, readsize, sampleRate)
-            AL.SourceQueueBuffer (sid, bid)
-            true
-        else false
+    // Queued buffers with the amount of samples in each, and buffers available for reuse.
+    let queued = new Queue<int * int> ()
+    let free = new Stack<int> ()
+    let mutable queuedSamples = 0
+
+    /// Queues a buffer holding the given amount of samples.
+    let queue bid samples =
+        AL.SourceQueueBuffer (sid, bid)
+        queued.Enqueue ((bid, samples))
+        queuedSamples <- queuedSamples + samples
+
+    /// Gets a buffer to write to.
+    let next () = if free.Count > 0 then free.Pop () else AL.GenBuffer ()
+
+    /// Writes the next data from the input into an OpenAL buffer and queues it. Returns false if there is no more data to
+    /// be written.
+    let write () =
+        match parameters.Input with
+        | StreamInput stream ->
+            let readsize = stream.Object.Read (transfer, 0, bufferSize)
+            if readsize > 0 then
+                let bid = next ()
+                AL.BufferData (bid, format, transfer, readsize, sampleRate)
+                queue bid (readsize / bytesPerSample)
+                true
+            else false
+        | ContextInput (context, contentIndex) ->
+            let audio = context.Object.Content.[contentIndex] :?> AudioContent
+            let mutable written = false
+            let mutable ended = false
+            while not written && not ended do
+                let mutable index = 0
+                if not (context.Object.NextFrame (&index)) then ended <- true
+                elif index = contentIndex then
+                    match audio.Data with
+                    | Some data when data.Size > 0UL ->
+                        let size = int data.Size
+                        let bid = next ()
+                        match data with
+                        | :? AudioFrame as frame ->
+                            AL.BufferData (bid, format, frame.Buffer.Start, size, sampleRate)
+                            frame.Return ()
+                        | :? BufferData<byte> as data -> AL.BufferData (bid, format, data.Buffer.Start, size, sampleRate)
+                        | :? ArrayData<byte> as data when data.Offset = 0 -> AL.BufferData (bid, format, data.Array, size, sampleRate)
+                        | _ ->
+
+                            // Only data that is not already in memory that OpenAL can read from is copied.
+                            if transfer.Length < size then transfer <- Array.create size 0uy
+                            data.Read (0UL, transfer, 0, size)
+                            AL.BufferData (bid, format, transfer, size, sampleRate)
+                        queue bid (size / bytesPerSample)
+                        written <- true
+                    | _ -> ()
+            written
+
+    /// Queues buffers until the target amount of samples is queued or the input ends.
+    let fill () =
+        while not finished && queuedSamples < targetSamples do
+            if not (write ()) then finished <- true
 
     /// Write initial buffers.
-    do
-        let mutable t = 0
-        while t < bufferCount do
-            write (AL.GenBuffer ()) |> ignore
-            t <- t + 1
+    do fill ()
 
     /// Gets a signal feed that maintains the position of this source in its input stream.
     member this.Position = position :> SignalFeed<uint64>
 
+    /// Gets a signal feed giving the amount of times this source ran out of queued samples while playing.
+    member this.Underruns = underruns :> SignalFeed<int>
+
+    /// Gets the longest time, in milliseconds, that may pass between updates of this source without it running out of
+    /// queued samples.
+    member this.MaxWait = max 1 (int (float targetSamples * 250.0 / float sampleRate))
+
     /// Gets wether this source is playing.
     member this.Playing = playing
 
@@ -202,9 +288,12 @@ and private AudioOutputSource (parameters : AudioOutputSourceParameters, format
 
         let buffers = AL.SourceUnqueueBuffers (sid, bufferamount)
         AL.DeleteBuffers buffers
+        AL.DeleteBuffers (free.ToArray ())
         AL.DeleteSource sid
        
-        stream.Release.Invoke ()
+        match parameters.Input with
+        | StreamInput stream -> stream.Release.Invoke ()
+        | ContextInput (context, _) -> context.Release.Invoke ()
 
     /// Updates the state of this source and ensures play buffers are queued. Returns the amount of buffers processed since the last
     /// update.
@@ -212,16 +301,21 @@ and private AudioOutputSource (parameters : AudioOutputSourceParameters, format
         let mutable buffersprocessed = 0
         AL.GetSource (sid, ALGetSourcei.BuffersProcessed, &buffersprocessed)
 
-        // Refill processed buffers
+        // Recycle processed buffers
         if buffersprocessed > 0 then
-            startPosition <- startPosition + uint64 (buffersprocessed * samplesPerBuffer)
-
-            let buffers = AL.SourceUnqueueBuffers (sid, buffersprocessed)
-            for buffer in buffers do
-                write buffer |> ignore
-
+            AL.SourceUnqueueBuffers (sid, buffersprocessed) |> ignore
+            for t = 1 to buffersprocessed do
+                let bid, samples = queued.Dequeue ()
+                startPosition <- startPosition + uint64 samples
+                queuedSamples <- queuedSamples - samples
+                free.Push bid
+        fill ()
+
+        // A source that stopped on its own while playing ran out of queued samples.
         if playing && AL.GetSourceState sid <> ALSourceState.Playing then
-            AL.SourcePlay sid
+            if AL.GetSourceState sid = ALSourceState.Stopped && not (finished && queued.Count = 0) then
+                underruns.Update (underruns.Current + 1)
+            if queued.Count > 0 then AL.SourcePlay sid
 
         // Update play position
         let mutable sampleoffset = 0
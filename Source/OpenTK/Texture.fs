@@ -33,6 +33,41 @@ type Texture (id : int) =
             let data = Image.toBGRA32 (image, size)
             GL.TexImage2D (TextureTarget.Texture2D, level, PixelInternalFormat.Rgba, size.Width, size.Height, 0, PixelFormat.Bgra, PixelType.UnsignedByte, data)
 
+    /// Gets the texture formats and the amount of bytes per texel used to upload a plane of video frames in the given
+    /// format, or None if the plane can not be uploaded directly. Planes of YUV formats are uploaded as they are, leaving
+    /// conversion to RGB to the renderer.
+    static member PlaneFormat (format : VideoFormat, plane : int) =
+        match (format, plane) with
+        | (VideoFormat.RGB24, 0) -> Some (PixelInternalFormat.Rgb, PixelFormat.Rgb, 3)
+        | (VideoFormat.BGR24, 0) -> Some (PixelInternalFormat.Rgb, PixelFormat.Bgr, 3)
+        | (VideoFormat.RGBA, 0) -> Some (PixelInternalFormat.Rgba, PixelFormat.Rgba, 4)
+        | (VideoFormat.BGRA, 0) -> Some (PixelInternalFormat.Rgba, PixelFormat.Bgra, 4)
+        | (VideoFormat.YUYV422, 0) | (VideoFormat.UYVY422, 0) -> Some (PixelInternalFormat.Rgba, PixelFormat.Rgba, 4)
+        | (VideoFormat.NV12, 1) | (VideoFormat.NV21, 1) -> Some (PixelInternalFormat.LuminanceAlpha, PixelFormat.LuminanceAlpha, 2)
+        | (VideoFormat.PAL8, _) | (VideoFormat.ARGB, _) | (VideoFormat.ABGR, _) -> None
+        | _ -> Some (PixelInternalFormat.Luminance, PixelFormat.Luminance, 1)
+
+    /// Sets the image for the given mipmap level of the currently-bound 2d texture from a plane of a video frame. The
+    /// texture must already have the size of the plane. The driver reads the plane straight from decoder memory, picking
+    /// out the rows with the unpack parameters, so the plane is copied only once.
+    static member SetPlane (plane : VideoPlane, format : PixelFormat, bytesPerTexel : int, level : int) =
+        let width = plane.Width / bytesPerTexel
+        let start = plane.Buffer.Start
+        let alignment = [8; 4; 2; 1] |> List.tryFind (fun a -> (plane.Width + a - 1) / a * a = plane.Stride)
+        if plane.Stride % bytesPerTexel = 0 || alignment.IsSome then
+            match alignment with
+            | Some alignment -> GL.PixelStore (PixelStoreParameter.UnpackAlignment, alignment)
+            | None ->
+                GL.PixelStore (PixelStoreParameter.UnpackAlignment, 1)
+                GL.PixelStore (PixelStoreParameter.UnpackRowLength, plane.Stride / bytesPerTexel)
+            GL.TexSubImage2D (TextureTarget.Texture2D, level, 0, 0, width, plane.Height, format, PixelType.UnsignedByte, start)
+        else
+            GL.PixelStore (PixelStoreParameter.UnpackAlignment, 1)
+            for row = 0 to plane.Height - 1 do
+                GL.TexSubImage2D (TextureTarget.Texture2D, level, 0, row, width, 1, format, PixelType.UnsignedByte, start + nativeint (row * plane.Stride))
+        GL.PixelStore (PixelStoreParameter.UnpackRowLength, 0)
+        GL.PixelStore (PixelStoreParameter.UnpackAlignment, 4)
+
     /// Sets the wrap mode for the currently-bound texture.
     static member SetWrapMode (target, horizontal : TextureWrapMode, vertical : TextureWrapMode) =
         GL.TexParameter (target, TextureParameterName.TextureWrapS, int horizontal)
@@ -57,4 +92,37 @@ type Texture (id : int) =
     member this.Bind2D () = GL.BindTexture (TextureTarget.Texture2D, id)
 
     /// Deletes this texture.
-    member this.Delete () = GL.DeleteTexture id
\ No newline at end of file
+    member this.Delete () = GL.DeleteTexture id
+
+/// A set of textures holding the planes of video frames, one texture per plane that can be uploaded. Planes are given to
+/// the driver straight from decoder memory.
+type VideoTexture () =
+    let textures = Array.create 4 (None : Texture option)
+    let sizes = Array.create 4 (0, 0)
+
+    /// Gets the texture for the plane with the given index, or None if that plane has not been uploaded.
+    member this.Plane (index : int) = textures.[index]
+
+    /// Updates the textures in this set from the planes of the given frame. This binds each updated texture in turn.
+    member this.Update (frame : VideoFrame) =
+        for index = 0 to frame.PlaneCount - 1 do
+            let plane = frame.Plane index
+            match Texture.PlaneFormat (frame.Format, index) with
+            | Some (internalFormat, format, bytesPerTexel) when plane.Stride > 0 ->
+                let size = (plane.Width / bytesPerTexel, plane.Height)
+                match textures.[index] with
+                | Some texture when sizes.[index] = size -> texture.Bind2D ()
+                | current ->
+                    current |> Option.iter (fun texture -> texture.Delete ())
+                    let texture = Texture.Create ()
+                    Texture.SetFilterMode (TextureTarget.Texture2D, TextureMinFilter.Linear, TextureMagFilter.Linear)
+                    GL.TexImage2D (TextureTarget.Texture2D, 0, internalFormat, fst size, snd size, 0, format, PixelType.UnsignedByte, 0n)
+                    textures.[index] <- Some texture
+                    sizes.[index] <- size
+                Texture.SetPlane (plane, format, bytesPerTexel, 0)
+            | _ -> ()
+
+    /// Deletes the textures for this set.
+    member this.Delete () =
+        for texture in textures do
+            texture |> Option.iter (fun texture -> texture.Delete ())
\ No newline at end of file
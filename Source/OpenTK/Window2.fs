@@ -42,23 +42,29 @@ type Window () =
             context 
             |> Exclusive.bind (fun context -> 
                 Stream.chunk 1 () (fun () -> 
-                    let mutable index = 0
-                    if context.NextFrame (&index)
+
+                    // Frames of other content may still be given when ignored content is not skipped.
+                    let mutable index = -1
+                    let mutable more = true
+                    while more && index <> 0 do
+                        more <- context.NextFrame (&index)
+                    if more
                     then Some (audiocontent.Data.Value.Lock (), ())
                     else None)) 
-        let data = Data.make 65536 stream
+        let data = Data.makeSized audiocontent.OutputSize 65536 stream
         let floatData = Data.combine 4 (fun (x, o) -> float (BitConverter.ToInt16 (x, o)) / 32768.0) data
 
         // Play audio
         let sampleRate = audiocontent.SampleRate
         let audioparams = {
-                Stream = data.Lock ()
+                Input = StreamInput (data.Lock ())
                 SampleRate = int sampleRate
                 Channels = audiocontent.Channels
                 Format = audiocontent.Format
                 Control = control
                 Volume = Feed.constant 1.0
                 Pitch = Feed.constant 1.0
+                Latency = 0.0
             }
         let playPosition = (audiooutput.Begin audioparams).Value.Position
 
@@ -93,7 +99,7 @@ type Window () =
         let spectrogram = new Spectrogram (floatData, frame)
         let coloring = Map.func (fun (freq, value) -> value * (1.0e2 * freq)) |> Map.map gradient
         let area = new Rectangle (-1.0, 1.0, -1.0, 0.0) 
-        let spectrogram = spectrogram.CreateFigure (coloring, area)
+        let spectrogram = (spectrogram.CreateTiles SpectrogramTiling.Default).CreateFigure (coloring, area)
 
         // Figure
         let getLineFigure playSample =
@@ -0,0 +1,65 @@
+﻿namespace MD
+
+open System
+open System.Collections.Generic
+
+/// A persistent store of container probe results, keyed by file path, size and modification time. The format of each
+/// result is chosen by the container implementation that stores it, but may not contain tabs or line breaks.
+[<Sealed>]
+type ProbeCache (file : Path) =
+    let entries = new Dictionary<string, int64 * int64 * string> ()
+    let mutable changed = false
+    let save () =
+        lock entries (fun () ->
+            if changed then
+                let lines = entries |> Seq.map (fun kvp ->
+                    let (size, time, result) = kvp.Value
+                    sprintf "%s\t%d\t%d\t%s" kvp.Key size time result)
+                IO.File.WriteAllLines (file.Source, lines)
+                changed <- false)
+    do
+        if file.FileExists then
+            for line in IO.File.ReadAllLines file.Source do
+                match line.Split '\t' with
+                | [| path; size; time; result |] ->
+                    match Int64.TryParse size, Int64.TryParse time with
+                    | (true, size), (true, time) -> entries.[path] <- (size, time, result)
+                    | _ -> ()
+                | _ -> ()
+
+    /// Gets the name of the local file the given data is read from, or null if it is not known.
+    static member FileName (data : Data<byte>) =
+        match data with
+        | :? IOData as io ->
+            match io.Source with
+            | :? IO.FileStream as fs -> fs.Name
+            | _ -> null
+        | :? MappedData as mapped -> mapped.Name
+        | _ -> null
+
+    /// Gets the file this cache is stored in.
+    member this.File = file
+
+    /// Tries getting the stored probe result for the file with the given name. If there is no result, or the file has
+    /// changed since the result was stored, None is returned.
+    member this.TryGet (filename : string) =
+        let info = new IO.FileInfo (filename)
+        lock entries (fun () ->
+            match entries.TryGetValue info.FullName with
+            | (true, (size, time, result)) when info.Exists && size = info.Length && time = info.LastWriteTimeUtc.Ticks -> Some result
+            | _ -> None)
+
+    /// Stores the probe result for the file with the given name.
+    member this.Set (filename : string, result : string) =
+        let info = new IO.FileInfo (filename)
+        if info.Exists then
+            lock entries (fun () ->
+                entries.[info.FullName] <- (info.Length, info.LastWriteTimeUtc.Ticks, result)
+                changed <- true)
+
+    /// Writes this cache to its file if it has changed since it was loaded or last saved. This is also done when the cache
+    /// is disposed.
+    member this.Save () = save ()
+
+    interface IDisposable with
+        member this.Dispose () = save ()
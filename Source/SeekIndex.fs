@@ -0,0 +1,111 @@
+﻿namespace MD
+
+open System
+open System.Collections.Generic
+
+/// The positions of packets in a stream of audio content, each given with the amount of samples decoded from the stream before
+/// that packet. Entries are kept in order of both sample and position.
+[<Sealed; AllowNullLiteral>]
+type SeekTable (sampleRate : int) =
+    let samples = new List<int64> ()
+    let positions = new List<int64> ()
+
+    /// Gets the sample rate of the stream this table is for.
+    member this.SampleRate = sampleRate
+
+    /// Gets the amount of entries in this table.
+    member this.Count = samples.Count
+
+    /// Gets the sample at which the entry with the given index begins.
+    member this.Sample (index : int) = samples.[index]
+
+    /// Gets the byte position of the packet for the entry with the given index.
+    member this.Position (index : int) = positions.[index]
+
+    /// Adds an entry to the end of this table, if it begins at least the given amount of samples after the last entry.
+    /// Returns wether the entry was added.
+    member this.Add (sample : int64, position : int64, interval : int64) =
+        let count = samples.Count
+        if count = 0 || (sample >= samples.[count - 1] + interval && position > positions.[count - 1]) then
+            samples.Add sample
+            positions.Add position
+            true
+        else false
+
+    /// Finds the index of the last entry that begins at or before the given sample, or -1 if there is none.
+    member this.Find (sample : int64) =
+        let mutable low = 0
+        let mutable high = samples.Count - 1
+        let mutable result = -1
+        while low <= high do
+            let mid = (low + high) / 2
+            if samples.[mid] <= sample then
+                result <- mid
+                low <- mid + 1
+            else high <- mid - 1
+        result
+
+/// A persistent store of seek tables for local files, kept in a directory with one file for each indexed file. Stored tables
+/// are discarded when the indexed file changes in size or modification time.
+[<Sealed>]
+type SeekIndex (directory : Path) =
+    static let magic = 0x4953444D
+    static let version = 1
+
+    /// Gets the directory this index is stored in.
+    member this.Directory = directory
+
+    /// Gets the path the tables for the file with the given name are stored at.
+    member this.IndexFile (filename : string) =
+        let path = (new IO.FileInfo (filename)).FullName.ToLowerInvariant ()
+        directory + sprintf "%016X.idx" (Util.hashString path)
+
+    /// Tries loading the stored tables, by stream index, for the file with the given name. If there are none, or the file
+    /// has changed since they were stored, None is returned.
+    member this.TryLoad (filename : string) =
+        let info = new IO.FileInfo (filename)
+        let file = this.IndexFile filename
+        if not info.Exists || not file.FileExists then None
+        else
+            try
+                use reader = new IO.BinaryReader (IO.File.OpenRead file.Source)
+                if reader.ReadInt32 () <> magic || reader.ReadInt32 () <> version || reader.ReadString () <> info.FullName ||
+                    reader.ReadInt64 () <> info.Length || reader.ReadInt64 () <> info.LastWriteTimeUtc.Ticks then None
+                else
+                    let tables = new Dictionary<int, SeekTable> ()
+                    for t = 1 to reader.ReadInt32 () do
+                        let stream = reader.ReadInt32 ()
+                        let table = new SeekTable (reader.ReadInt32 ())
+                        for e = 1 to reader.ReadInt32 () do
+                            let sample = reader.ReadInt64 ()
+                            table.Add (sample, reader.ReadInt64 (), 0L) |> ignore
+                        tables.[stream] <- table
+                    Some tables
+            with
+            | :? IO.IOException | :? UnauthorizedAccessException -> None
+
+    /// Stores the tables, by stream index, for the file with the given name. Returns false if they could not be stored.
+    member this.Save (filename : string, tables : IDictionary<int, SeekTable>) =
+        let info = new IO.FileInfo (filename)
+        if not info.Exists then false
+        else
+            try
+                directory.MakeDirectory () |> ignore
+                use writer = new IO.BinaryWriter (IO.File.Create (this.IndexFile filename).Source)
+                writer.Write magic
+                writer.Write version
+                writer.Write info.FullName
+                writer.Write info.Length
+                writer.Write info.LastWriteTimeUtc.Ticks
+                writer.Write tables.Count
+                for kvp in tables do
+                    let table = kvp.Value
+                    writer.Write kvp.Key
+                    writer.Write table.SampleRate
+                    writer.Write table.Count
+                    for e = 0 to table.Count - 1 do
+                        writer.Write (table.Sample e)
+                        writer.Write (table.Position e)
+                true
+            with
+            | :? IO.IOException | :? UnauthorizedAccessException -> false
@@ -29,6 +29,13 @@ type ArrayStream<'a when 'a : unmanaged> (array : 'a[], offset : int) =
     /// Gets the current offset of the stream in the source array.
     member this.Offset = offset
 
+    /// Advances this stream by the given amount of items without reading them. Returns the amount of
+    /// items skipped, which will be under the requested size if the end of the stream has been reached.
+    member this.Skip size =
+        let skipSize = min size (array.Length - offset)
+        offset <- offset + skipSize
+        skipSize
+
     override this.Read (targetArray, targetOffset, size) =
         let readSize = min size (array.Length - offset)
         Array.blit array offset targetArray targetOffset readSize
@@ -45,6 +52,11 @@ type BufferStream<'a when 'a : unmanaged> (buffer : Buffer<'a>) =
     /// advances in memory location with each read operation.
     member this.Buffer = buffer
 
+    /// Advances this stream by the given amount of items without reading them.
+    member this.Skip size =
+        buffer <- buffer.Advance size
+        size
+
     override this.Read (array, offset, size) =
         Buffer.copyba buffer array offset size
         buffer <- buffer.Advance size
@@ -8,12 +8,23 @@ type AudioControl =
     | Pause
     | Stop
 
+/// Identifies where an audio output source reads its samples from.
+type AudioOutputInput =
+
+    /// A stream from which the raw audio data is read. Note that multichannel samples should be interleaved
+    /// in this stream.
+    | StreamInput of Stream<byte> exclusive
+
+    /// A context and the index of the audio content in it whose decoded frames are given directly to the output. The
+    /// output format, sample rate and channels of the content are set to those of the output source, and all other content
+    /// of the context is ignored.
+    | ContextInput of Context exclusive * int
+
 /// Contains parameters for an audio output source.
 type AudioOutputSourceParameters = {
 
-    /// The stream from which the raw audio data is read. Note that multichannel samples should be interleaved
-    /// in this stream.
-    Stream : Stream<byte> exclusive
+    /// The input from which samples are read.
+    Input : AudioOutputInput
 
     /// The sample rate, in samples per second for the audio output.
     SampleRate : int
@@ -32,6 +43,11 @@ type AudioOutputSourceParameters = {
 
     /// A feed giving pitch (sample rate multiplier) of the audio output.
     Pitch : float signal
+
+    /// The target latency, in seconds, between reading samples and hearing them. The output keeps about this much audio
+    /// queued, so lower latencies need more frequent updates and are more prone to underruns. If this is 0, a default
+    /// suitable for playback is used.
+    Latency : float
     }
 
 /// Contains information about an active audio output source.
@@ -39,6 +55,9 @@ type AudioOutputSource = {
 
     /// The currently playing sample in relation to the start of the source stream.
     Position : uint64 signal
+
+    /// The amount of times the output ran out of queued samples while playing.
+    Underruns : int signal
 }
 
 /// An interface to an audio output device.
@@ -2,6 +2,7 @@
 
 open System
 open System.Collections.Generic
+open System.Threading.Tasks
 
 open MD
 open MD.Util
@@ -27,6 +28,336 @@ type SpectrogramFrame =
             let bandwidth = center / q
             { Window = window; Bandwidth = bandwidth; Center = center }
 
+/// Scratch buffers used by one worker to compute rows of a spectrogram.
+[<Sealed>]
+type internal SpectrogramScratch (kernelSize : int) =
+    let tempArray = Array.zeroCreate<Complex> kernelSize
+    let outputArray = Array.zeroCreate<Complex> kernelSize
+    let tempBuffer, unpinTemp = Buffer.PinArray tempArray
+    let outputBuffer, unpinOutput = Buffer.PinArray outputArray
+
+    /// Gets the buffer the windowed spectral content for a row is read to.
+    member this.Temp = tempBuffer
+
+    /// Gets the buffer the transformed content for a row is written to.
+    member this.Output = outputBuffer
+
+    /// Gets the array for the output buffer.
+    member this.OutputArray = outputArray
+
+    /// Computes the rows of a spectrogram in parallel from the given spectrum, using a discrete kernel for each row. Each
+    /// worker has its own scratch buffers, and the given function is called with the index and output of each row once it
+    /// is transformed. The spectrum and kernels are only read, and each row is computed exactly as it would be serially.
+    static member ComputeRows (spectrumBuffer : Buffer<Complex>, spectrumSize : int, kernels : DiscreteKernel[], kernelSize : int, row : int -> Complex[] -> unit) =
+        let dft = DFT.get kernelSize
+        let init () = new SpectrogramScratch (kernelSize)
+        let body (t : int) (_ : ParallelLoopState) (scratch : SpectrogramScratch) =
+            Frame.applyDiscreteKernel spectrumBuffer spectrumSize kernels.[t] scratch.Temp
+            Util.conjugate scratch.Temp kernelSize
+            dft.ComputeComplex (scratch.Temp, scratch.Output)
+            row t scratch.OutputArray
+            scratch
+        let release (scratch : SpectrogramScratch) = (scratch :> IDisposable).Dispose ()
+        Parallel.For (0, kernels.Length, Func<_> init, Func<_, _, _, _> body, Action<_> release) |> ignore
+
+    interface IDisposable with
+        member this.Dispose () =
+            unpinTemp ()
+            unpinOutput ()
+
+/// Parameters for dividing a spectrogram into tiles over time.
+type SpectrogramTiling = {
+
+    /// The amount of columns in each tile. This should be a power of two.
+    TileWidth : int
+
+    /// The amount of rows, from the lowest to the highest frequency, in each tile.
+    Height : int
+
+    /// The amount of samples between columns at the finest level of detail. This should be a power of two.
+    Hop : int
+
+    /// The maximum amount of tiles kept in memory.
+    Capacity : int
+
+    } with
+
+    /// The default tiling parameters.
+    static member Default = {
+            TileWidth = 256
+            Height = 256
+            Hop = 64
+            Capacity = 512
+        }
+
+/// A spectrogram divided into tiles over time, at several levels of detail. Each tile at the finest level (level 0) covers
+/// TileWidth * Hop samples, and is computed from a window of twice that size centered on the tile. Each tile at a coarser
+/// level combines the two tiles below it. Tiles are computed as samples are pushed to the spectrogram, or on demand from a
+/// source of samples if one is given, in which case coarse tiles are sampled from a bounded amount of finest tiles so that
+/// no request transforms the whole source. The most recently used tiles are kept in memory. Tiles hold the squared magnitude
+/// of each component, with each row (starting at the lowest frequency) stored contiguously.
+type SpectrogramTiles (frame : SpectrogramFrame, tiling : SpectrogramTiling, sampleCount : int64, source : Data<float> option) =
+    let width = tiling.TileWidth
+    let height = tiling.Height
+    let tileSamples = width * tiling.Hop
+    let segmentSize = tileSamples * 2
+    let kernelSize = width * 2
+    let kernels = Array.init height (fun index ->
+        let kernel = frame.GetKernel (float index / float height)
+        (kernel, Frame.createDiscreteKernel segmentSize kernelSize kernel))
+    let discreteKernels = kernels |> Array.map snd
+    let tileCount = max 1L ((sampleCount + int64 tileSamples - 1L) / int64 tileSamples)
+    let levels =
+        let mutable levels = 1
+        while (1L <<< (levels - 1)) < tileCount do
+            levels <- levels + 1
+        levels
+    let empty = Array.zeroCreate<float32> (width * height)
+    let sync = new Object ()
+    let cache = new ManualCache<int * int64, float32[]> ((fun _ -> empty), ignore)
+    let waiters = new Dictionary<int * int64, List<float32[] -> unit>> ()
+
+    // The window of samples for the next finest tile to be computed from pushed samples. The window starts half a tile
+    // before the tile.
+    let window = Array.zeroCreate<float> segmentSize
+    let mutable windowFill = tileSamples / 2
+    let mutable nextTile = 0L
+    let mutable pushed = 0L
+
+    /// Computes a tile at the finest level from the window of samples centered on it.
+    let computeTile (segment : float[]) =
+        let spectrumArray = Array.zeroCreate<Complex> segmentSize
+        let segmentBuffer, unpinSegment = Buffer.PinArray segment
+        let spectrumBuffer, unpinSpectrum = Buffer.PinArray spectrumArray
+
+        DFT.computeReal segmentBuffer spectrumBuffer segmentSize
+        let tile = Array.zeroCreate<float32> (width * height)
+        SpectrogramScratch.ComputeRows (spectrumBuffer, segmentSize, discreteKernels, kernelSize, fun t output ->
+
+            // The middle half of the output covers the tile.
+            let row = t * width
+            for x = 0 to width - 1 do
+                tile.[row + x] <- float32 (output.[x + width / 2].SquareAbs / float kernelSize))
+
+        unpinSegment ()
+        unpinSpectrum ()
+        tile
+
+    /// Combines two adjacent tiles into a tile of the next coarser level. A missing tile is taken to be empty.
+    let merge (left : float32[]) (right : float32[]) =
+        let tile = Array.zeroCreate<float32> (width * height)
+        let half = width / 2
+        for t = 0 to height - 1 do
+            let row = t * width
+            for x = 0 to half - 1 do
+                if left <> null then tile.[row + x] <- (left.[row + x * 2] + left.[row + x * 2 + 1]) * 0.5f
+                if right <> null then tile.[row + half + x] <- (right.[row + x * 2] + right.[row + x * 2 + 1]) * 0.5f
+        tile
+
+    /// Stores a tile in the cache, gives it to the callbacks waiting for it, and combines it with its sibling, if available,
+    /// into the tile above it.
+    let rec store (level : int) (index : int64) (tile : float32[]) =
+        let waiting, sibling, parent =
+            lock sync (fun () ->
+                if (cache.Fetch (level, index)).IsNone then cache.Submit ((level, index), tile)
+                if cache.Size > tiling.Capacity then cache.Collect (cache.Size - tiling.Capacity)
+                let waiting =
+                    match waiters.TryGetValue ((level, index)) with
+                    | (true, list) ->
+                        waiters.Remove ((level, index)) |> ignore
+                        list.ToArray ()
+                    | _ -> [| |]
+                let parent = if level + 1 < levels then cache.Fetch (level + 1, index / 2L) else None
+                waiting, cache.Fetch (level, index ^^^ 1L), parent)
+        for callback in waiting do
+            callback tile
+        if level + 1 < levels && parent.IsNone then
+            match sibling with
+            | Some sibling ->
+                let left, right = if index % 2L = 0L then tile, sibling else sibling, tile
+                store (level + 1) (index / 2L) (merge left right)
+            | None -> ()
+
+    /// Computes the finest tile with the given index from the source of samples, without storing it.
+    let computeFinest (index : int64) =
+        let start = index * int64 tileSamples - int64 (tileSamples / 2)
+        match source with
+        | Some data when start < int64 data.Size ->
+            let segment = Array.zeroCreate<float> segmentSize
+            data.ReadSafe (start, segment, 0, segmentSize)
+            computeTile segment
+        | _ -> empty
+
+    /// Computes a coarse tile with a column for each group of finest tiles it covers, where each column is the average
+    /// of the finest tile in the middle of its group. This transforms TileWidth finest tiles, whatever the level.
+    let sample (level : int) (index : int64) =
+        let group = (1L <<< level) / int64 width
+        let tile = Array.zeroCreate<float32> (width * height)
+        for x = 0 to width - 1 do
+            let finest = (index <<< level) + int64 x * group + group / 2L
+            if finest < tileCount then
+                let column = computeFinest finest
+                for t = 0 to height - 1 do
+                    let row = t * width
+                    let mutable total = 0.0f
+                    for c = 0 to width - 1 do
+                        total <- total + column.[row + c]
+                    tile.[row + x] <- total / float32 width
+        tile
+
+    /// Computes the tile at the given level and index from the source of samples. Tiles covering at most TileWidth finest
+    /// tiles combine the tiles below them, and coarser tiles are sampled, so coarse tiles are available before the finer
+    /// tiles below them. Finer tiles are computed as they are requested, as the view is refined.
+    let rec compute (level : int) (index : int64) =
+        match lock sync (fun () -> cache.Fetch (level, index)) with
+        | Some tile -> tile
+        | None ->
+            let tile =
+                if (index <<< level) >= tileCount || source.IsNone then empty
+                elif level = 0 then computeFinest index
+                elif (1L <<< level) <= int64 width then merge (compute (level - 1) (index * 2L)) (compute (level - 1) (index * 2L + 1L))
+                else sample level index
+            store level index tile
+            tile
+
+    /// Computes the next finest tile from the full window of pushed samples, then advances the window to the next tile.
+    let step () =
+        store 0 nextTile (computeTile window)
+        nextTile <- nextTile + 1L
+        Array.Copy (window, tileSamples, window, 0, segmentSize - tileSamples)
+        windowFill <- segmentSize - tileSamples
+
+    /// Gets the parameters for the tiles of this spectrogram.
+    member this.Tiling = tiling
+
+    /// Gets the amount of levels of detail in this spectrogram. The coarsest level has a single tile.
+    member this.Levels = levels
+
+    /// Gets the amount of samples covered by each tile at the given level.
+    member this.TileSamples (level : int) = int64 tileSamples <<< level
+
+    /// Gets the kernel for each row of the tiles of this spectrogram.
+    member this.Kernels = kernels |> Array.map fst
+
+    /// Tries getting the tile at the given level and index, if it is in memory.
+    member this.TryGet (level : int, index : int64) = lock sync (fun () -> cache.Fetch (level, index))
+
+    /// Calls the given callback with the tile at the given level and index once it is available. If this spectrogram has
+    /// a source of samples, the tile is computed on a background task. Otherwise, it is given once enough samples have
+    /// been pushed.
+    member this.Request (level : int, index : int64, callback : float32[] -> unit) =
+        let ready =
+            lock sync (fun () ->
+                match cache.Fetch (level, index) with
+                | Some tile -> Some tile
+                | None when source.IsSome -> None
+                | None ->
+                    let list =
+                        match waiters.TryGetValue ((level, index)) with
+                        | (true, list) -> list
+                        | _ ->
+                            let list = new List<float32[] -> unit> ()
+                            waiters.[(level, index)] <- list
+                            list
+                    list.Add callback
+                    Some null)
+        match ready with
+        | Some null -> Action.Custom (fun () -> lock sync (fun () -> match waiters.TryGetValue ((level, index)) with | (true, list) -> list.Remove callback |> ignore | _ -> ()))
+        | Some tile ->
+            callback tile
+            Action.Nil
+        | None -> (Query.task (fun () -> compute level index)).Register callback
+
+    /// Appends samples to the signal of this spectrogram, computing the finest tiles (and the tiles above them) that the
+    /// samples complete.
+    member this.Push (samples : float[], offset : int, count : int) =
+        let mutable offset = offset
+        let mutable count = count
+        pushed <- pushed + int64 count
+        while count > 0 do
+            let size = min count (segmentSize - windowFill)
+            Array.Copy (samples, offset, window, windowFill, size)
+            windowFill <- windowFill + size
+            offset <- offset + size
+            count <- count - size
+            if windowFill = segmentSize then step ()
+
+    /// Completes the tiles covering the end of the pushed signal, taking the signal to be silent past its end.
+    member this.Finish () =
+        let total = max 1L ((pushed + int64 tileSamples - 1L) / int64 tileSamples)
+        while nextTile < total do
+            Array.Clear (window, windowFill, segmentSize - windowFill)
+            windowFill <- segmentSize
+            step ()
+
+        // Tiles without a right sibling are combined with an empty tile.
+        for level = 0 to levels - 2 do
+            let last = (total - 1L) >>> level
+            if last % 2L = 0L then
+                match this.TryGet (level, last) with
+                | Some tile when (this.TryGet (level + 1, last / 2L)).IsNone -> store (level + 1) (last / 2L) (merge tile null)
+                | _ -> ()
+
+    /// Pushes the samples of the given audio content of a context to this spectrogram, mixing its channels together, until
+    /// the context has no more frames, then finishes the spectrogram. This may be run on a background thread.
+    member this.Feed (context : Context, contentIndex : int) =
+        let audio = context.Content.[contentIndex] :?> AudioContent
+        audio.OutputFormat <- AudioFormat.Float
+        audio.Planar <- false
+        let mutable bytes = Array.zeroCreate<byte> 0
+        let mutable samples = Array.zeroCreate<float> 0
+        let mutable index = 0
+        while context.NextFrame (&index) do
+            match audio.Data with
+            | Some data when index = contentIndex ->
+                let channels = audio.OutputChannels
+                let size = int data.Size
+                if bytes.Length < size then bytes <- Array.zeroCreate size
+                data.Read (0UL, bytes, 0, size)
+                match data with
+                | :? AudioFrame as frame -> frame.Return ()
+                | _ -> ()
+                let count = size / (4 * channels)
+                if samples.Length < count then samples <- Array.zeroCreate count
+                for t = 0 to count - 1 do
+                    let mutable total = 0.0
+                    for c = 0 to channels - 1 do
+                        total <- total + float (BitConverter.ToSingle (bytes, (t * channels + c) * 4))
+                    samples.[t] <- total / float channels
+                this.Push (samples, 0, count)
+            | _ -> ()
+        this.Finish ()
+
+    /// Creates a figure to display this spectrogram in the given area. Finer tiles are shown as the figure is enlarged, and
+    /// tiles are loaded in the background once they become visible.
+    member this.CreateFigure (coloring : SpectrogramColoring, area : Rectangle) =
+        let size = new ImageSize (width, height)
+        let resolution = sqrt (float width * float height)
+        let tileFigure (tile : float32[]) =
+            let image = new ArrayImage<Color> (width, height)
+            for t = 0 to height - 1 do
+                let kernel, _ = kernels.[t]
+                let row = t * width
+                for x = 0 to width - 1 do
+                    image.[x, height - t - 1] <- coloring.[kernel.Center, float tile.[row + x]]
+            Figure.image (Image.opaque image, size) ImageInterpolation.Linear
+        let tileQuery level index =
+            { new Query<Figure> () with
+                member x.Register callback = this.Request (level, index, tileFigure >> callback) }
+        let leftArea = new Rectangle (0.0, 0.5, 0.0, 1.0)
+        let rightArea = new Rectangle (0.5, 1.0, 0.0, 1.0)
+        let rec node level (index : int64) =
+            if (index <<< level) >= tileCount then Figure.nil
+            else
+                let tile = Figure.query (tileQuery level index)
+                if level = 0 then tile
+                else
+                    let left = Figure.transform (Transform.Place leftArea) (node (level - 1) (index * 2L))
+                    let right = Figure.transform (Transform.Place rightArea) (node (level - 1) (index * 2L + 1L))
+                    let finer = Figure.bounded leftArea left + Figure.bounded rightArea right
+                    Figure.lod tile finer resolution
+        Figure.transform (Transform.Place area) (node (levels - 1) 0L)
+
 /// A time-frequency representation of a discrete waveform derived using a certain frame
 type Spectrogram (samples : Data<float>, frame : SpectrogramFrame) =
 
@@ -36,6 +367,9 @@ type Spectrogram (samples : Data<float>, frame : SpectrogramFrame) =
     /// Gets the frame for this spectrogram.
     member this.Frame = frame
 
+    /// Creates tiles for this spectrogram, computed on demand from its samples.
+    member this.CreateTiles (tiling : SpectrogramTiling) = new SpectrogramTiles (frame, tiling, int64 samples.Size, Some samples)
+
     /// Creates a figure to display this spectrogram.
     member this.CreateFigure (coloring : SpectrogramColoring, area : Rectangle) =
         let sampleCount = samples.Size |> int |> npow2i
@@ -51,26 +385,17 @@ type Spectrogram (samples : Data<float>, frame : SpectrogramFrame) =
         let sampleArray = Array.zeroCreate<float> sampleCount
         samples.ReadSafe (0L, sampleArray, 0, sampleCount)
 
-        let outputArray = Array.zeroCreate<Complex> width
         let spectrumArray = Array.zeroCreate<Complex> sampleCount
         let spectrumBuffer, unpinSpectrum = Buffer.PinArray spectrumArray
         let sampleBuffer, unpinSample = Buffer.PinArray sampleArray
-        let outputBuffer, unpinOutput = Buffer.PinArray outputArray
 
         DFT.computeReal sampleBuffer spectrumBuffer sampleCount
-        let dft = DFT.get width
-        for t = 0 to height - 1 do
-            let kernel, discreteKernel = kernels.[t]
-            let tempBuffer = sampleBuffer.Cast ()
-            Frame.applyDiscreteKernel spectrumBuffer sampleCount discreteKernel tempBuffer
-            Util.conjugate tempBuffer width
-            dft.ComputeComplex (tempBuffer, outputBuffer)
-
+        SpectrogramScratch.ComputeRows (spectrumBuffer, sampleCount, Array.map snd kernels, width, fun t output ->
+            let kernel, _ = kernels.[t]
             for x = 0 to width - 1 do
-                image.[x, height - t - 1] <- coloring.[kernel.Center, outputBuffer.[x].SquareAbs / float width]
+                image.[x, height - t - 1] <- coloring.[kernel.Center, output.[x].SquareAbs / float width])
 
         unpinSpectrum ()
         unpinSample ()
-        unpinOutput ()
 
         Figure.placeImage area (Image.opaque image, image.Size) ImageInterpolation.Linear
\ No newline at end of file
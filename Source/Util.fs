@@ -28,6 +28,14 @@ let pin (obj : 'a[]) =
 /// Releases the given pinned handle.
 let unpin (handle : GCHandle) = handle.Free()
 
+/// Computes the 64-bit FNV-1a hash of the characters of a string. Unlike String.GetHashCode, the hash is the same on every
+/// run, so it can name the files of persistent stores.
+let internal hashString (value : string) =
+    let mutable hash = 14695981039346656037UL
+    for c in value do
+        hash <- (hash ^^^ uint64 c) * 1099511628211UL
+    hash
+
 /// Reverses the order of the bits in an integer.
 let bitrev (x : uint32) =
     let x = ((x &&& 0xaaaaaaaau) >>> 1) ||| ((x &&& 0x55555555u) <<< 1)